@@ -0,0 +1,52 @@
+#include "scanner.hpp"
+#include "inputstream/fileinputstream.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+static double seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Scan the file over and over for about a second, without compiling, and report the scanner's speed
+static void scanFile(const char* path) {
+    FileInputStream stream;
+    if( !stream.open(path) ){
+        fprintf(stderr, "Could not open file '%s'\n", path);
+        exit(74);
+    }
+
+    Scanner scanner;
+    long tokens = 0;
+    double bytes = 0;
+    int passes = 0;
+    double start = seconds();
+    double elapsed;
+    do{
+        scanner.init(&stream);
+        for(;;){
+            Token token = scanner.scanToken();
+            if( token.type == Token::END ) break;
+            tokens++;
+        }
+        bytes += (double)scanner.getOffset();
+        passes++;
+        elapsed = seconds() - start;
+    }while( elapsed < 1.0 );
+
+    printf("%ld tokens in %d passes of %.0f bytes: %.2f Mtokens/s, %.1f MB/s\n",
+        tokens, passes, bytes / passes, (double)tokens / elapsed * 1e-6, bytes / elapsed * 1e-6);
+}
+
+int main(int argc, char const * argv[]) {
+    if( argc != 2 ){
+        fprintf(stderr, "Usage: scanbench path\n");
+        return 64;
+    }
+    scanFile(argv[1]);
+    return 0;
+}
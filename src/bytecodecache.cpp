@@ -0,0 +1,712 @@
+#include "bytecodecache.hpp"
+#include "optimiser.hpp"
+#include "str.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+static char const MAGIC_[4] = {'S', 'G', 'L', 'C'};
+
+// Header flags: options which change the generated code
+static uint32_t const FLAG_OPTIMISED_ = 1 << 0;
+
+// Literal tags
+enum : uint8_t {
+    LITERAL_NIL_,
+    LITERAL_FALSE_,
+    LITERAL_TRUE_,
+    LITERAL_NUMBER_,
+    LITERAL_TYPEID_,
+    LITERAL_STRING_,
+    LITERAL_FUNCTION_,
+};
+
+// Deepest nesting of functions accepted when reading, so a damaged file can't overflow the C stack
+static int const MAX_DEPTH_ = 256;
+
+static size_t const MAX_CODE_ = 65535;
+
+// Values a frame may hold: no more than the VM's whole stack
+static int const MAX_FRAME_VALUES_ = 64 * 256;
+
+// Stack heights recorded for each byte of code while checking it
+static int const NOT_AN_INSTRUCTION_ = -2;
+static int const NOT_REACHED_ = -1;
+
+
+BytecodeCache::BytecodeCache(Mem * mem, Options const & options) : mem_(mem), options_(options) {
+    pos_ = nullptr;
+    end_ = nullptr;
+}
+
+BytecodeCache::~BytecodeCache() {
+}
+
+std::string BytecodeCache::cachePath_(char const * path) {
+    return std::string(path) + "c";
+}
+
+bool BytecodeCache::makeHeader_(char const * path, Header * header) {
+    struct stat st;
+    if( stat(path, &st) != 0 ) return false;
+
+    memset(header, 0, sizeof(Header));
+    memcpy(header->magic, MAGIC_, sizeof(MAGIC_));
+    header->version = VERSION;
+    header->flags = options_.optimise ? FLAG_OPTIMISED_ : 0;
+    header->sourceSize = (int64_t)st.st_size;
+    header->sourceMtimeSec = (int64_t)st.st_mtim.tv_sec;
+    header->sourceMtimeNsec = (int64_t)st.st_mtim.tv_nsec;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Loading
+//-----------------------------------------------------------------------------
+
+ObjFunction * BytecodeCache::load(char const * path) {
+    Header expected;
+    if( !makeHeader_(path, &expected) ) return nullptr;
+
+    int fd = open(cachePath_(path).c_str(), O_RDONLY);
+    if( fd < 0 ) return nullptr;
+
+    struct stat st;
+    if( fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header) ){
+        close(fd);
+        return nullptr;
+    }
+    size_t size = (size_t)st.st_size;
+    void * mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if( mapped == MAP_FAILED ) return nullptr;
+
+    pos_ = (uint8_t const *)mapped;
+    end_ = pos_ + size;
+
+    ObjFunction * script = nullptr;
+    Header header;
+    if( readBytes_(&header, sizeof(Header)) && memcmp(&header, &expected, sizeof(Header)) == 0 ){
+        script = readFunction_(0);
+        if( pos_ != end_ ) script = nullptr;  // trailing junk: don't trust it
+    }
+
+    munmap(mapped, size);
+    pos_ = nullptr;
+    end_ = nullptr;
+    loaded_.clear();
+    return script;
+}
+
+void BytecodeCache::gcMarkRoots() {
+    for( Obj * obj : loaded_ ){
+        obj->gcMark();
+    }
+}
+
+bool BytecodeCache::readBytes_(void * bytes, size_t length) {
+    if( (size_t)(end_ - pos_) < length ) return false;
+    memcpy(bytes, pos_, length);
+    pos_ += length;
+    return true;
+}
+
+bool BytecodeCache::readUint32_(uint32_t * n) {
+    return readBytes_(n, sizeof(uint32_t));
+}
+
+ObjString * BytecodeCache::readString_() {
+    uint32_t length;
+    if( !readUint32_(&length) || (size_t)(end_ - pos_) < length || length > INT32_MAX ) return nullptr;
+    ObjString * str = ObjString::newString(mem_, (char const *)pos_, (int)length);
+    pos_ += length;
+    loaded_.push_back(str);
+    return str;
+}
+
+ObjFunction * BytecodeCache::readFunction_(int depth) {
+    if( depth > MAX_DEPTH_ ) return nullptr;
+
+    ObjString * name = readString_();
+    if( name == nullptr ) return nullptr;
+
+    uint32_t numInputs, numUpvalues, isGenerator, codeLength, numLines, numLiterals;
+    if( !readUint32_(&numInputs) || !readUint32_(&numUpvalues) || !readUint32_(&isGenerator)
+            || !readUint32_(&codeLength) ){
+        return nullptr;
+    }
+    if( numInputs > 255 || numUpvalues > 255 || isGenerator > 1 || codeLength > MAX_CODE_ ) return nullptr;
+    if( (size_t)(end_ - pos_) < codeLength ) return nullptr;
+
+    ObjFunction * fn = new ObjFunction(mem_, name);
+    loaded_.push_back(fn);
+    fn->numInputs = (int)numInputs;
+    fn->numUpvalues = (int)numUpvalues;
+    fn->isGenerator = isGenerator != 0;
+
+    Chunk & chunk = fn->chunk;
+    chunk.code.assign(pos_, pos_ + codeLength);
+    pos_ += codeLength;
+
+    // Line runs must cover the code from its start, in order:
+    if( !readUint32_(&numLines) || numLines > codeLength ) return nullptr;
+    if( (codeLength == 0) != (numLines == 0) ) return nullptr;
+    chunk.lines.resize(numLines);
+    if( !readBytes_(chunk.lines.data(), numLines * sizeof(LineNum)) ) return nullptr;
+    for( uint32_t i = 0; i < numLines; ++i ){
+        uint32_t start = i == 0 ? 0 : chunk.lines[i - 1].offset + 1u;
+        if( chunk.lines[i].offset < start || chunk.lines[i].offset >= codeLength ) return nullptr;
+    }
+    if( numLines > 0 && chunk.lines[0].offset != 0 ) return nullptr;
+
+    if( !readUint32_(&numLiterals) || numLiterals > Chunk::MAX_LITERALS ) return nullptr;
+    for( uint32_t i = 0; i < numLiterals; ++i ){
+        if( !readLiteral_(fn, depth) ) return nullptr;
+    }
+
+    // Inlined calls must cover runs of the code in order, each named by a string literal:
+    uint32_t numInlined;
+    if( !readUint32_(&numInlined) || numInlined > codeLength ) return nullptr;
+    for( uint32_t i = 0; i < numInlined; ++i ){
+        uint32_t start, end, line, nameIndex;
+        if( !readUint32_(&start) || !readUint32_(&end) || !readUint32_(&line) || !readUint32_(&nameIndex) ){
+            return nullptr;
+        }
+        uint32_t after = chunk.inlinedCalls.empty() ? 0 : chunk.inlinedCalls.back().end;
+        if( start < after || end <= start || end > codeLength || line > UINT16_MAX ) return nullptr;
+        if( nameIndex >= numLiterals || !chunk.literals[nameIndex].isString() ) return nullptr;
+        chunk.inlinedCalls.push_back({(uint16_t)start, (uint16_t)end, (uint16_t)line, nameIndex});
+    }
+
+    // The script is called with nothing but itself on the stack:
+    if( depth == 0 && (fn->numInputs != 0 || fn->numUpvalues != 0 || fn->isGenerator) ) return nullptr;
+    if( !checkCode_(fn, depth == 0) ) return nullptr;
+    return fn;
+}
+
+bool BytecodeCache::readLiteral_(ObjFunction * fn, int depth) {
+    uint8_t tag;
+    if( !readBytes_(&tag, 1) ) return false;
+
+    Value value;
+    switch( tag ){
+        case LITERAL_NIL_: value = Value::nil(); break;
+        case LITERAL_FALSE_: value = Value::boolean(false); break;
+        case LITERAL_TRUE_: value = Value::boolean(true); break;
+        case LITERAL_NUMBER_: {
+            double n;
+            if( !readBytes_(&n, sizeof(double)) ) return false;
+            value = Value::number(n);
+            break;
+        }
+        case LITERAL_TYPEID_: {
+            uint8_t t;
+            if( !readBytes_(&t, 1) || t > Value::GENERATOR ) return false;
+            value = Value::typeId((Value::Type)t);
+            break;
+        }
+        case LITERAL_STRING_: {
+            ObjString * str = readString_();
+            if( str == nullptr ) return false;
+            value = Value::string(str);
+            break;
+        }
+        case LITERAL_FUNCTION_: {
+            ObjFunction * nested = readFunction_(depth + 1);
+            if( nested == nullptr ) return false;
+            value = Value::function(nested);
+            break;
+        }
+        default:
+            return false;
+    }
+
+    // Literals were unique when written, so they must land at the next index
+    uint32_t expected = (uint32_t)fn->chunk.numLiterals();
+    return fn->chunk.addLiteral(value) == expected;
+}
+
+//-----------------------------------------------------------------------------
+// Checking loaded code
+//-----------------------------------------------------------------------------
+
+static int readUint16_(uint8_t const * code) {
+    return (code[0] << 8) | code[1];
+}
+
+static uint32_t readIndex_(uint8_t const * code) {
+    return ((uint32_t)code[0] << 16) | ((uint32_t)code[1] << 8) | code[2];
+}
+
+static bool isStringLiteral_(Chunk & chunk, uint32_t index) {
+    return index < (uint32_t)chunk.numLiterals() && chunk.getLiteral(index).isString();
+}
+
+// The body of a numeric for loop, from just after its FOR_PREP to just after its FOR_STEP.
+// FOR_STEP trusts that the iterator, limit and step in the slots from slot onwards are as FOR_PREP left them,
+// so nothing else in the body may change them, and the body can only be entered through the FOR_PREP.
+struct ForLoop_ {
+    int prep;
+    int begin;
+    int end;
+    int slot;
+
+    bool contains(int offset) const { return offset >= begin && offset < end; }
+    bool isFixed(int local) const { return local >= slot && local < slot + 3; }
+};
+
+// Control passes from one instruction to target with depth values in the frame:
+// target must be the start of an instruction, reached with the same depth every way
+static bool flowTo_(std::vector<int> & depthAt, std::vector<int> & pending, std::vector<ForLoop_> const & loops,
+        int from, int target, int depth) {
+    if( target < 0 || target >= (int)depthAt.size() ) return false;
+    for( ForLoop_ const & loop : loops ){
+        if( loop.contains(target) && !loop.contains(from) && from != loop.prep ) return false;
+    }
+    int & known = depthAt[(size_t)target];
+    if( known == NOT_AN_INSTRUCTION_ ) return false;
+    if( known == NOT_REACHED_ ){
+        known = depth;
+        pending.push_back(target);
+        return true;
+    }
+    return known == depth;
+}
+
+// Whether a closure of fn could set its upvalue index, itself or through closures it makes
+static bool setsUpvalue_(ObjFunction * fn, int index) {
+    Chunk & chunk = fn->chunk;
+    uint8_t const * code = chunk.getCode();
+    for( int at = 0; at < chunk.count(); at += Optimiser::instructionLength(&chunk, at) ){
+        uint8_t op = code[at];
+        if( op == OpCode::SET_UPVALUE && code[at + 1] == index ) return true;
+        if( op != OpCode::CLOSURE && op != OpCode::CLOSURE_LONG ) continue;
+        bool isLong = op == OpCode::CLOSURE_LONG;
+        ObjFunction * nested = chunk.getLiteral(isLong ? readIndex_(code + at + 1) : code[at + 1]).asObjFunction();
+        uint8_t const * captures = code + at + (isLong ? 4 : 2);
+        for( int i = 0; i < nested->numUpvalues; ++i ){
+            if( !captures[2 * i] && captures[2 * i + 1] == index && setsUpvalue_(nested, i) ) return true;
+        }
+    }
+    return false;
+}
+
+static bool checkClosure_(ObjFunction * fn, int offset, int depth, std::vector<ForLoop_> const & loops) {
+    Chunk & chunk = fn->chunk;
+    uint8_t const * ip = chunk.getCode() + offset;
+    bool isStack = ip[0] == OpCode::CLOSURE_STACK;
+    bool isLong = ip[0] == OpCode::CLOSURE_LONG;
+    ObjFunction * nested = chunk.getLiteral(isLong ? readIndex_(ip + 1) : ip[1]).asObjFunction();
+    uint8_t const * captures = ip + (isLong ? 4 : 2);
+
+    // Each upvalue captures a local of this frame (after the function in slot 0), or one of this closure's upvalues:
+    for( int i = 0; i < nested->numUpvalues; ++i ){
+        bool isLocal = captures[2 * i] != 0;
+        int index = captures[2 * i + 1];
+        if( isLocal ? (index == 0 || index >= depth) : (isStack || index >= fn->numUpvalues) ) return false;
+        if( !isLocal || isStack ) continue;
+        for( ForLoop_ const & loop : loops ){
+            if( loop.contains(offset) && loop.isFixed(index) && setsUpvalue_(nested, i) ) return false;
+        }
+    }
+
+    // A CLOSURE_STACK closure reads the slots of this frame in place of upvalues, so the frame can't move,
+    // and anything else can't read them:
+    if( isStack && (fn->isGenerator || nested->isGenerator) ) return false;
+    Chunk & nestedChunk = nested->chunk;
+    uint8_t const * code = nestedChunk.getCode();
+    for( int at = 0; at < nestedChunk.count(); at += Optimiser::instructionLength(&nestedChunk, at) ){
+        uint8_t op = code[at];
+        if( op == OpCode::GET_ENCLOSING || op == OpCode::SET_ENCLOSING ){
+            if( !isStack ) return false;
+            int slot = code[at + 1];
+            bool isCaptured = false;
+            for( int i = 0; i < nested->numUpvalues; ++i ){
+                if( captures[2 * i + 1] == slot ) isCaptured = true;
+            }
+            if( !isCaptured ) return false;
+            for( ForLoop_ const & loop : loops ){
+                if( op == OpCode::SET_ENCLOSING && loop.contains(offset) && loop.isFixed(slot) ) return false;
+            }
+        }else if( isStack && (op == OpCode::GET_UPVALUE || op == OpCode::SET_UPVALUE) ){
+            // ...and it has no upvalues of its own
+            return false;
+        }
+    }
+    return true;
+}
+
+bool BytecodeCache::checkCode_(ObjFunction * fn, bool isScript) {
+    Chunk & chunk = fn->chunk;
+    uint8_t const * code = chunk.getCode();
+    int count = chunk.count();
+    uint32_t numLiterals = (uint32_t)chunk.numLiterals();
+
+    // Decode it first, so every instruction is whole:
+    std::vector<int> depthAt((size_t)count, NOT_AN_INSTRUCTION_);
+    std::vector<ForLoop_> loops;
+    for( int offset = 0; offset < count; ){
+        uint8_t op = code[offset];
+        if( op == OpCode::CLOSURE || op == OpCode::CLOSURE_STACK || op == OpCode::CLOSURE_LONG ){
+            // the length comes from the function literal
+            bool isLong = op == OpCode::CLOSURE_LONG;
+            if( offset + (isLong ? 3 : 1) >= count ) return false;
+            uint32_t index = isLong ? readIndex_(code + offset + 1) : code[offset + 1];
+            if( index >= numLiterals || !chunk.getLiteral(index).isFunction() ) return false;
+        }else if( op == OpCode::SWITCH_STRING ){
+            // the hash table's size must be in the code, and a table of 2 << 15 bytes wouldn't fit
+            if( offset + 3 >= count || code[offset + 3] >= 15 ) return false;
+        }
+        int length = Optimiser::instructionLength(&chunk, offset);
+        if( length == 0 || offset + length > count ) return false;
+        if( op == OpCode::FOR_PREP || op == OpCode::FOR_PREP_INCLUSIVE ){
+            loops.push_back({offset, offset + 4, offset + 4 + readUint16_(code + offset + 2), code[offset + 1]});
+        }
+        depthAt[(size_t)offset] = NOT_REACHED_;
+        offset += length;
+    }
+
+    // Then follow every path through it, keeping track of how many values the frame has on the stack:
+    std::vector<int> pending;
+    if( !flowTo_(depthAt, pending, loops, -1, 0, 1 + fn->numInputs) ) return false;
+    while( !pending.empty() ){
+        int offset = pending.back();
+        pending.pop_back();
+        int depth = depthAt[(size_t)offset];
+        uint8_t const * ip = code + offset;
+        int next = offset + Optimiser::instructionLength(&chunk, offset);
+
+        int pops = 0;
+        int pushes = 0;
+        int jump = -1;  // where it may go instead of on to next
+        bool carriesOn = true;
+        switch( ip[0] ){
+            case OpCode::PUSH_ZERO:
+            case OpCode::PUSH_ONE:
+            case OpCode::NIL:
+            case OpCode::TRUE:
+            case OpCode::FALSE:
+            case OpCode::TYPE_BOOL:
+            case OpCode::TYPE_FLOAT:
+            case OpCode::TYPE_FUNCTION:
+            case OpCode::TYPE_STRING:
+            case OpCode::TYPE_TYPEID:
+                pushes = 1;
+                break;
+            case OpCode::LITERAL:
+                if( ip[1] >= numLiterals ) return false;
+                pushes = 1;
+                break;
+            case OpCode::LITERAL_LONG:
+                if( readIndex_(ip + 1) >= numLiterals ) return false;
+                pushes = 1;
+                break;
+            case OpCode::CLOSURE:
+            case OpCode::CLOSURE_LONG:
+            case OpCode::CLOSURE_STACK:
+                if( !checkClosure_(fn, offset, depth, loops) ) return false;
+                pushes = 1;
+                break;
+
+            case OpCode::POP:
+            case OpCode::CLOSE_UPVALUE:
+                pops = 1;
+                break;
+            case OpCode::PEEK:
+                if( ip[1] >= depth ) return false;
+                pushes = 1;
+                break;
+            case OpCode::POP_UNDER:
+                pops = 1 + ip[1];
+                pushes = 1;
+                break;
+
+            case OpCode::DEFINE_GLOBAL_VAR:
+            case OpCode::DEFINE_GLOBAL_CONST:
+                if( !isStringLiteral_(chunk, ip[1]) ) return false;
+                pops = 1;
+                break;
+            case OpCode::DEFINE_GLOBAL_VAR_LONG:
+            case OpCode::DEFINE_GLOBAL_CONST_LONG:
+                if( !isStringLiteral_(chunk, readIndex_(ip + 1)) ) return false;
+                pops = 1;
+                break;
+            case OpCode::GET_GLOBAL:
+                if( !isStringLiteral_(chunk, ip[1]) ) return false;
+                pushes = 1;
+                break;
+            case OpCode::GET_GLOBAL_LONG:
+                if( !isStringLiteral_(chunk, readIndex_(ip + 1)) ) return false;
+                pushes = 1;
+                break;
+            case OpCode::SET_GLOBAL:
+                if( !isStringLiteral_(chunk, ip[1]) ) return false;
+                pops = pushes = 1;
+                break;
+            case OpCode::SET_GLOBAL_LONG:
+                if( !isStringLiteral_(chunk, readIndex_(ip + 1)) ) return false;
+                pops = pushes = 1;
+                break;
+
+            case OpCode::GET_LOCAL:
+                if( ip[1] >= depth ) return false;
+                pushes = 1;
+                break;
+            case OpCode::SET_LOCAL:
+                // slot 0 holds the function being run
+                if( ip[1] == 0 || ip[1] >= depth ) return false;
+                for( ForLoop_ const & loop : loops ){
+                    if( loop.contains(offset) && loop.isFixed(ip[1]) ) return false;
+                }
+                pops = pushes = 1;
+                break;
+            case OpCode::GET_UPVALUE:
+                if( ip[1] >= fn->numUpvalues ) return false;
+                pushes = 1;
+                break;
+            case OpCode::SET_UPVALUE:
+                if( ip[1] >= fn->numUpvalues ) return false;
+                pops = pushes = 1;
+                break;
+            case OpCode::GET_ENCLOSING:
+            case OpCode::SET_ENCLOSING:
+                // the slot is checked against the CLOSURE_STACK which makes the closure
+                if( isScript ) return false;
+                pops = ip[0] == OpCode::SET_ENCLOSING ? 1 : 0;
+                pushes = 1;
+                break;
+
+            case OpCode::EQUAL:
+            case OpCode::NOT_EQUAL:
+            case OpCode::GREATER:
+            case OpCode::GREATER_EQUAL:
+            case OpCode::LESS:
+            case OpCode::LESS_EQUAL:
+            case OpCode::ADD:
+            case OpCode::SUBTRACT:
+            case OpCode::MULTIPLY:
+            case OpCode::DIVIDE:
+            case OpCode::INDEX_GET:
+                pops = 2;
+                pushes = 1;
+                break;
+            case OpCode::NEGATE:
+            case OpCode::NOT:
+            case OpCode::PRINT:
+            case OpCode::ECHO:
+            case OpCode::TYPE:
+                pops = pushes = 1;
+                break;
+            case OpCode::MAKE_LIST:
+                pops = ip[1];
+                pushes = 1;
+                break;
+            case OpCode::INDEX_SET:
+                pops = 3;
+                pushes = 1;
+                break;
+
+            case OpCode::JUMP:
+                jump = next + readUint16_(ip + 1);
+                carriesOn = false;
+                break;
+            case OpCode::LOOP:
+                jump = next - readUint16_(ip + 1);
+                carriesOn = false;
+                break;
+            case OpCode::JUMP_IF_TRUE:
+            case OpCode::JUMP_IF_FALSE:
+                pops = pushes = 1;
+                jump = next + readUint16_(ip + 1);
+                break;
+            case OpCode::JUMP_IF_TRUE_POP:
+            case OpCode::JUMP_IF_FALSE_POP:
+                pops = 1;
+                jump = next + readUint16_(ip + 1);
+                break;
+            case OpCode::FOR_PREP:
+            case OpCode::FOR_PREP_INCLUSIVE:
+                // the iterator and the limit are on top, and the step goes above them
+                if( ip[1] + 2 != depth ) return false;
+                pushes = 1;
+                jump = next + readUint16_(ip + 2);
+                break;
+            case OpCode::FOR_STEP:{
+                // loops back to the start of the body of the FOR_PREP with the same iterator
+                int begin = next - readUint16_(ip + 2);
+                bool isLoop = false;
+                for( ForLoop_ const & loop : loops ){
+                    if( loop.begin == begin && loop.slot == ip[1] && loop.contains(offset) ) isLoop = true;
+                }
+                if( !isLoop || ip[1] + 3 != depth ) return false;
+                jump = begin;
+                break;
+            }
+            case OpCode::JUMP_TABLE:
+            case OpCode::SWITCH_STRING:{
+                // the value stays on the stack, and one of the jumps after the table is taken
+                if( depth < 2 ) return false;
+                int numCases = readUint16_(ip + (ip[0] == OpCode::JUMP_TABLE ? 3 : 1));
+                if( ip[0] == OpCode::SWITCH_STRING ){
+                    int tableSize = 1 << ip[3];
+                    uint8_t const * table = ip + 4;
+                    uint8_t const * literals = table + 2 * tableSize;
+                    bool hasFreeSlot = false;  // so a search for a string which isn't there ends
+                    for( int slot = 0; slot < tableSize; ++slot ){
+                        int c = readUint16_(table + 2 * slot);
+                        if( c == UINT16_MAX ) hasFreeSlot = true;
+                        else if( c >= numCases ) return false;
+                    }
+                    if( !hasFreeSlot ) return false;
+                    for( int c = 0; c < numCases; ++c ){
+                        if( !isStringLiteral_(chunk, readIndex_(literals + 3 * c)) ) return false;
+                    }
+                }
+                for( int entry = 0; entry <= numCases; ++entry ){
+                    int target = next + 3 * entry;
+                    if( target >= count || (code[target] != OpCode::JUMP && code[target] != OpCode::LOOP) ) return false;
+                    if( !flowTo_(depthAt, pending, loops, offset, target, depth) ) return false;
+                }
+                carriesOn = false;
+                break;
+            }
+
+            case OpCode::CALL:
+                pops = 1 + ip[1];
+                pushes = 1;
+                break;
+            case OpCode::RETURN:
+                // the script leaves nothing but itself and the result
+                if( isScript && depth != 2 ) return false;
+                pops = 1;
+                carriesOn = false;
+                break;
+            case OpCode::YIELD:
+                if( !fn->isGenerator ) return false;
+                pops = pushes = 1;
+                break;
+
+            default:
+                return false;
+        }
+
+        // Slot 0 holds the function being run, and only RETURN takes it off.
+        // Nor can a loop's body take off its iterator, limit or step:
+        int floor = 1;
+        for( ForLoop_ const & loop : loops ){
+            if( loop.contains(offset) && loop.slot + 3 > floor ) floor = loop.slot + 3;
+        }
+        if( depth - pops < floor ) return false;
+        depth += pushes - pops;
+        if( depth > MAX_FRAME_VALUES_ ) return false;
+        if( jump != -1 && !flowTo_(depthAt, pending, loops, offset, jump, depth) ) return false;
+        if( carriesOn && !flowTo_(depthAt, pending, loops, offset, next, depth) ) return false;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Saving
+//-----------------------------------------------------------------------------
+
+bool BytecodeCache::save(char const * path, ObjFunction * script) {
+    Header header;
+    if( !makeHeader_(path, &header) ) return false;
+
+    out_.clear();
+    writeBytes_(&header, sizeof(Header));
+    if( !writeFunction_(script) ){
+        out_.clear();
+        return false;
+    }
+
+    // Write to a temporary file and rename it into place, so a reader never sees half a cache
+    std::string cachePath = cachePath_(path);
+    std::string tmpPath = cachePath + ".tmp";
+    FILE * file = fopen(tmpPath.c_str(), "wb");
+    if( file == nullptr ){
+        out_.clear();
+        return false;
+    }
+    bool ok = fwrite(out_.data(), 1, out_.size(), file) == out_.size();
+    ok = (fclose(file) == 0) && ok;
+    ok = ok && rename(tmpPath.c_str(), cachePath.c_str()) == 0;
+    if( !ok ){
+        remove(tmpPath.c_str());
+    }
+    out_.clear();
+    out_.shrink_to_fit();
+    return ok;
+}
+
+void BytecodeCache::writeBytes_(void const * bytes, size_t length) {
+    uint8_t const * b = (uint8_t const *)bytes;
+    out_.insert(out_.end(), b, b + length);
+}
+
+void BytecodeCache::writeUint32_(uint32_t n) {
+    writeBytes_(&n, sizeof(uint32_t));
+}
+
+void BytecodeCache::writeString_(ObjString * str) {
+    writeUint32_((uint32_t)str->getLength());
+    writeBytes_(str->getCString(), (size_t)str->getLength());
+}
+
+bool BytecodeCache::writeFunction_(ObjFunction * fn) {
+    Chunk & chunk = fn->chunk;
+    writeString_(fn->name);
+    writeUint32_((uint32_t)fn->numInputs);
+    writeUint32_((uint32_t)fn->numUpvalues);
+    writeUint32_(fn->isGenerator ? 1 : 0);
+    writeUint32_((uint32_t)chunk.code.size());
+    writeBytes_(chunk.code.data(), chunk.code.size());
+    writeUint32_((uint32_t)chunk.lines.size());
+    writeBytes_(chunk.lines.data(), chunk.lines.size() * sizeof(LineNum));
+    writeUint32_((uint32_t)chunk.literals.size());
+    for( Value & literal : chunk.literals ){
+        if( !writeLiteral_(literal) ) return false;
+    }
+    writeUint32_((uint32_t)chunk.inlinedCalls.size());
+    for( InlinedCall & call : chunk.inlinedCalls ){
+        writeUint32_(call.start);
+        writeUint32_(call.end);
+        writeUint32_(call.line);
+        writeUint32_(call.name);
+    }
+    return true;
+}
+
+bool BytecodeCache::writeLiteral_(Value value) {
+    switch( value.type ){
+        case Value::NIL:
+            out_.push_back(LITERAL_NIL_);
+            return true;
+        case Value::BOOL:
+            out_.push_back(value.as.boolean ? LITERAL_TRUE_ : LITERAL_FALSE_);
+            return true;
+        case Value::NUMBER:
+            out_.push_back(LITERAL_NUMBER_);
+            writeBytes_(&value.as.number, sizeof(double));
+            return true;
+        case Value::TYPEID:
+            out_.push_back(LITERAL_TYPEID_);
+            out_.push_back((uint8_t)value.as.typeId);
+            return true;
+        case Value::STRING:
+            out_.push_back(LITERAL_STRING_);
+            writeString_(value.asObjString());
+            return true;
+        case Value::FUNCTION:
+            out_.push_back(LITERAL_FUNCTION_);
+            return writeFunction_(value.asObjFunction());
+        default:
+            // Runtime-only objects are never literals
+            return false;
+    }
+}
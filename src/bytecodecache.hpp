@@ -0,0 +1,81 @@
+#pragma once
+
+#include "mem.hpp"
+#include "value.hpp"
+#include "options.hpp"
+#include "function.hpp"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/**
+ * Compiled scripts saved as a binary file next to their source ("script.sigil" -> "script.sigilc"),
+ * so that later runs can map the file in and skip scanning and compiling.
+ *
+ * The file holds the tree of functions: name, arity, upvalue count, generator flag, code, line number runs,
+ * literals and inlined calls, with nested functions written in place of their literal. Upvalue descriptors
+ * are operands of the CLOSURE instructions, so they come along with the code.
+ *
+ * A cache is only loaded if it has the current format version, was compiled with the same
+ * code generating options, and records the size and modification time of the source as it is now.
+ * Its code is decoded as it is read, and the cache ignored unless every instruction is whole,
+ * every operand in range and the stack the same height wherever control flow meets.
+ */
+class BytecodeCache {
+public:
+    BytecodeCache(Mem * mem, Options const & options);
+    ~BytecodeCache();
+
+    // @return the script function from a fresh cache of the source at path, or nullptr
+    ObjFunction * load(char const * path);
+
+    // Write the cache for the source at path.
+    // @return false if the source couldn't be found or the cache couldn't be written
+    bool save(char const * path, ObjFunction * script);
+
+    // Mark objects made while loading to protect from garbage collection
+    void gcMarkRoots();
+
+    // Bump whenever the format or the meaning of the bytecode changes
+    static uint32_t const VERSION = 9;
+
+private:
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint32_t flags;
+        uint32_t reserved;
+        int64_t sourceSize;
+        int64_t sourceMtimeSec;
+        int64_t sourceMtimeNsec;
+    };
+
+    static std::string cachePath_(char const * path);
+    bool makeHeader_(char const * path, Header * header);
+
+    // writing:
+    void writeBytes_(void const * bytes, size_t length);
+    void writeUint32_(uint32_t n);
+    void writeString_(ObjString * str);
+    bool writeFunction_(ObjFunction * fn);
+    bool writeLiteral_(Value value);
+
+    // reading, from the range [pos_, end_):
+    bool readBytes_(void * bytes, size_t length);
+    bool readUint32_(uint32_t * n);
+    ObjString * readString_();
+    ObjFunction * readFunction_(int depth);
+    bool readLiteral_(ObjFunction * fn, int depth);
+
+    // checking the code read, so that a damaged file can't take the VM out of bounds:
+    static bool checkCode_(ObjFunction * fn, bool isScript);
+
+    Mem * mem_;
+    Options options_;
+    std::vector<uint8_t> out_;  // file contents being written
+    uint8_t const * pos_;       // read position in mapped file
+    uint8_t const * end_;
+    std::vector<Obj *> loaded_; // objects made so far by load()
+};
@@ -2,6 +2,7 @@
 #include "chunk.hpp"
 
 #include <assert.h>
+#include <algorithm>
 
 
 static int const MAX_COUNT_ = 65535;
@@ -17,47 +18,84 @@ bool Chunk::write(uint8_t byte, uint16_t line) {
         return false;
     }
     code.push_back(byte);
-    lines.push_back(line);
+    addLine_((int)code.size() - 1, line);
     return true;
 }
 
+void Chunk::addLine_(int offset, uint16_t line) {
+    if( lines.empty() || lines.back().line != line ){
+        lines.push_back({(uint16_t)offset, line});
+    }
+}
+
 uint16_t Chunk::getLineNumber(int offset) {
-    if( offset < 0 || offset >= (int)lines.size() ) return -1;  // should never happen
-    return lines[offset];
+    if( offset < 0 || offset >= (int)code.size() ) return -1;  // should never happen
+    // Find the last run starting at or before offset:
+    auto after = std::upper_bound(lines.begin(), lines.end(), offset,
+        [](int offset, LineNum const & run){ return offset < run.offset; });
+    assert(after != lines.begin());
+    return (after - 1)->line;
 }
 
 int Chunk::count() {
     return (int)code.size();
 }
 
+void Chunk::truncate(int offset, int numLiterals) {
+    assert(offset >= 0 && offset <= (int)code.size());
+    assert(numLiterals >= 0 && numLiterals <= (int)literals.size());
+    code.resize((size_t)offset);
+    while( !lines.empty() && lines.back().offset >= offset ){
+        lines.pop_back();
+    }
+    while( !inlinedCalls.empty() && inlinedCalls.back().end > offset ){
+        inlinedCalls.pop_back();
+    }
+    for( size_t i = (size_t)numLiterals; i < literals.size(); ++i ){
+        literalIndices.erase(literals[i]);
+    }
+    literals.resize((size_t)numLiterals);
+}
+
+void Chunk::addInlinedCall(int start, uint16_t line, uint32_t name) {
+    assert(start >= 0 && start < (int)code.size());
+    inlinedCalls.push_back({(uint16_t)start, (uint16_t)code.size(), line, name});
+}
+
+InlinedCall const * Chunk::getInlinedCall(int offset) {
+    for( InlinedCall const & call : inlinedCalls ){
+        if( offset >= call.start && offset < call.end ) return &call;
+    }
+    return nullptr;
+}
+
 uint8_t * Chunk::getCode() {
     return &code[0];
 }
 
-uint8_t Chunk::addLiteral(Value value) {
+uint32_t Chunk::addLiteral(Value value) {
     // first, check if literal is already in array:
-    for( int i = 0; i < (int)literals.size(); ++i ){
-        if( value.equals(literals[i]) ){
-            return (uint8_t)i;
-        }
+    auto found = literalIndices.find(value);
+    if( found != literalIndices.end() ){
+        return found->second;
     }
 
-    int size = (int)literals.size();
-    if( size < MAX_LITERALS ){
-        literals.push_back(value);
-        return (uint8_t)size; // index of new literal
-    }else{
+    uint32_t index = (uint32_t)literals.size();
+    if( index >= MAX_LITERALS ){
         return MAX_LITERALS; // full!
     }
+    literals.push_back(value);
+    literalIndices.emplace(value, index);
+    return index;
 }
 
-Value Chunk::getLiteral(uint8_t index) {
+Value Chunk::getLiteral(uint32_t index) {
     assert(index < literals.size());
     return literals[index];
 }
 
-uint8_t Chunk::numLiterals() {
-    return (uint8_t)literals.size();
+int Chunk::numLiterals() {
+    return (int)literals.size();
 }
 
 void Chunk::gcMarkRefs() {
@@ -1,10 +1,12 @@
 #pragma once
 
 #include "value.hpp"
+#include "table.hpp"
 
 #include <stdint.h>
 #include <stddef.h>
 #include <vector>
+#include <unordered_map>
 
 namespace OpCode {
 enum {
@@ -12,7 +14,10 @@ enum {
     PUSH_ZERO,      // Push the value 0 to the stack
     PUSH_ONE,       // Push the value 1 to the stack
     LITERAL,        // Push a literal value from the chunk
+    LITERAL_LONG,   // LITERAL with a 3 byte literal index
     CLOSURE,        // Instantiate a function literal, making a closure
+    CLOSURE_LONG,   // CLOSURE with a 3 byte literal index
+    CLOSURE_STACK,  // CLOSURE for a closure which never outlives its frame, and reads the frame's slots directly
     NIL,            // Push nil to the stack
     TRUE,           // Push true to the stack
     FALSE,          // Push false to the stack
@@ -23,14 +28,22 @@ enum {
     TYPE_TYPEID,    // TypeId of TypeId
     // Stack and variable manipulation
     POP,            // Pop 1 value from the stack
+    PEEK,           // Push a copy of the value n below the top of the stack
+    POP_UNDER,      // Pop n values from under the top value
     DEFINE_GLOBAL_VAR,   // Define a global variable
+    DEFINE_GLOBAL_VAR_LONG,
     DEFINE_GLOBAL_CONST, // Define a global variable as const
+    DEFINE_GLOBAL_CONST_LONG,
     GET_GLOBAL,     // Push the value of a global to the stack
+    GET_GLOBAL_LONG,
     SET_GLOBAL,     // Set the value of a variable
+    SET_GLOBAL_LONG,
     GET_LOCAL,
     SET_LOCAL,
     GET_UPVALUE,
     SET_UPVALUE,
+    GET_ENCLOSING,  // Push a slot of the frame which made the (CLOSURE_STACK) closure
+    SET_ENCLOSING,  // Set a slot of the frame which made the (CLOSURE_STACK) closure
     CLOSE_UPVALUE,  // Remove 1 value, uplifting it to into an upvalue
     // Binary operators: take two values from the stack and push one:
     EQUAL,
@@ -46,15 +59,13 @@ enum {
     // Unary operators: take one value, push one value:
     NEGATE,
     NOT,
-    // Compare iterator takes two values, but leaves them on the stack
-    COMPARE_ITERATOR,   // Push -1 if <, 1 if >, 0 if difference is < 1
     // Built-ins:
     PRINT,              // Pop 1 value, print it, Push nil
     ECHO,               // Pop 1 value, print it, Push nil
     TYPE,               // Pop 1 value, Push 1 typeid
     MAKE_LIST,          // Pop n values into a list, Push list
-    INDEX_GET,          // TODO Pop 2 values as a,i, Push a[i]
-    INDEX_SET,          // TODO Pop 3 values as a,i,b; set a[i] = b; Push ???
+    INDEX_GET,          // Pop 2 values as a,i, Push a[i]
+    INDEX_SET,          // Pop 3 values as a,i,b; set a[i] = b; Push b
     // Control flow:
     JUMP,               // Unconditionally jump forward by bytecode offset 
     LOOP,               // Unconditionally jump backwards by bytecode offset 
@@ -62,15 +73,31 @@ enum {
     JUMP_IF_FALSE,      // If top of stack is falsy, jump fwd by bytecode offset
     JUMP_IF_TRUE_POP,   // Same as JUMP_IF_FALSE, but also pops the value
     JUMP_IF_FALSE_POP,  // Same as JUMP_IF_TRUE, but also pops the value
-    JUMP_IF_ZERO,       // If top of stack is zero, jump fwd by bytecode offset
+    // For loops keep the iterator, limit and step in locals slot, slot+1 and slot+2:
+    FOR_PREP,           // Push the step (+1 or -1) towards the limit, jump fwd if already within 1 of it
+    FOR_PREP_INCLUSIVE, // Same as FOR_PREP, also moving the limit a step further to include it
+    FOR_STEP,           // Add the step to the iterator, jump back unless now within 1 of the limit
+    // Switches are followed by a JUMP or LOOP for each case, then one for no match:
+    JUMP_TABLE,         // Skip to the case at (top of stack - min), for whole numbers in [min, min+count)
+    SWITCH_STRING,      // Skip to the case whose string is the top of stack, from a hash table of cases
     CALL,               // call function
     RETURN,
+    YIELD,              // Suspend the generator's frame, giving the resumer the top of stack (left in place)
 };
 }
 
+// A run of bytecode on one source line, starting at offset and ending where the next run starts
 struct LineNum {
-    uint16_t line;  // line number
-    uint8_t count;  // number of instructions on the line
+    uint16_t offset;  // position of the first byte in the bytecode array
+    uint16_t line;    // line number
+};
+
+// Bytecode inlined from a call, so runtime errors in it can still name the function
+struct InlinedCall {
+    uint16_t start;   // offset of the first byte of the inlined body
+    uint16_t end;     // offset just past the last one
+    uint16_t line;    // line of the body in the function
+    uint32_t name;    // literal index of the function's name
 };
 
 class Chunk {
@@ -88,28 +115,44 @@ public:
     // Get the length of the bytecode array
     int count();
 
+    // Discard the bytecode from offset onwards, and any literals from numLiterals onwards
+    void truncate(int offset, int numLiterals);
+
+    // Record that the bytecode from start to the end so far is the body of a call inlined from another function
+    void addInlinedCall(int start, uint16_t line, uint32_t name);
+
+    // The inlined call holding the byte at offset, or nullptr
+    InlinedCall const * getInlinedCall(int offset);
+
     // Get a pointer to the bytecode array
     uint8_t * getCode();
 
-    // Add a literal value and return its index
-    uint8_t addLiteral(Value value);
+    // Add a literal value and return its index (or MAX_LITERALS if full)
+    uint32_t addLiteral(Value value);
 
     // Get a literal value by its index
-    Value getLiteral(uint8_t index);
+    Value getLiteral(uint32_t index);
 
-    uint8_t numLiterals();
+    int numLiterals();
 
     // Mark referenced objects to protect from garbage collection
     void gcMarkRefs();
 
-    static uint8_t const MAX_LITERALS = 255;  // literal index must fit in a byte (for now)
+    // literal index must fit in 3 bytes (the _LONG instructions), or 1 byte for the short ones
+    static uint32_t const MAX_LITERALS = 1 << 24;
 
 private:
     std::vector<uint8_t> code;
-    std::vector<uint16_t> lines;    // line numbers corresponding to bytecode array
+    std::vector<LineNum> lines;     // line numbers of the bytecode array, run length encoded
+
+    void addLine_(int offset, uint16_t line);  // the byte at offset (the last one so far) is on line
+    std::vector<InlinedCall> inlinedCalls;    // in order of offset
     std::vector<Value> literals;
+    std::unordered_map<Value, uint32_t, ValueHash, ValueEqual> literalIndices;  // to reuse literals
 
     // Disassembler needs access within the chunk:
     friend class Disassembler;
+    friend class Optimiser;
+    friend class BytecodeCache;
 };
 
@@ -3,7 +3,11 @@
 #include "debug.hpp"
 #include "mem.hpp"
 #include "function.hpp"
+#include "optimiser.hpp"
+#include "str.hpp"
+#include "number.hpp"
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
@@ -11,11 +15,15 @@
 #include <vector>
 
 
-Environment::Environment(Mem * mem, ObjString * name, Type t) {
+Environment::Environment(Mem * mem, ObjString * name, Type t) 
+    : Environment(mem, new ObjFunction(mem, name), t) {
+}
+
+Environment::Environment(Mem * mem, ObjFunction * fn, Type t) {
     type = t;
     localCount = 0;
     scopeDepth = 0;
-    function = new ObjFunction(mem, name);
+    function = fn;
 
     // Claim first local, reserving space for the "stack pointer"
     Local * local = &locals[0];
@@ -23,7 +31,10 @@ Environment::Environment(Mem * mem, ObjString * name, Type t) {
     local->depth = 0;
     local->isDefined = false;
     local->isConst = false;
-    local->isCaptured = false;
+    local->numCaptures = 0;
+    local->closureOffset = -1;
+    local->isEscaping = false;
+    local->function = nullptr;
 
     // Now we have constructed the string, we can include the first local
     localCount = 1;
@@ -40,7 +51,10 @@ bool Environment::addLocal(ObjString * name, bool isConst) {
     local->depth = scopeDepth;
     local->isDefined = false;
     local->isConst = isConst;
-    local->isCaptured = false;
+    local->numCaptures = 0;
+    local->closureOffset = -1;
+    local->isEscaping = false;
+    local->function = nullptr;
     return true;
 }
 
@@ -74,26 +88,35 @@ int Environment::resolveLocal(Compiler * c, ObjString * name, bool & isConst) {
 
 int Environment::resolveUpvalue(Compiler * c, ObjString * name, bool & isConst) {
     // can't check enclosing env if already top-level:
-    if( enclosing == nullptr ) return Local::NOT_FOUND;
+    if( enclosing == nullptr ){
+        // but a lazily compiled function knows the names of its upvalues:
+        for( int i = 0; i < function->numUpvalues; i++ ){
+            if( upvalues[i].name == name ){
+                isConst = upvalues[i].isConst;
+                return i;
+            }
+        }
+        return Local::NOT_FOUND;
+    }
 
     // search for local in enclosing environment/function:
     int local = enclosing->resolveLocal(c, name, isConst);
     if( local != Local::NOT_FOUND ){
-        // that local is now captured
-        enclosing->locals[local].isCaptured = true;
-        return addUpvalue(c, (uint8_t)local, isConst, true);
+        // that local is now captured, and if it is a function it could be used anywhere
+        enclosing->locals[local].isEscaping = true;
+        return addUpvalue(c, name, (uint8_t)local, isConst, true);
     }
 
     // search for upvalue in enclosing environment/function:
     int upvalue = enclosing->resolveUpvalue(c, name, isConst);
     if( upvalue != Local::NOT_FOUND ){
-        return addUpvalue(c, (uint8_t)upvalue, isConst, false);
+        return addUpvalue(c, name, (uint8_t)upvalue, isConst, false);
     }
 
     return Local::NOT_FOUND;
 }
 
-int Environment::addUpvalue(Compiler * c, uint8_t index, bool isConst, bool isLocal) {
+int Environment::addUpvalue(Compiler * c, ObjString * name, uint8_t index, bool isConst, bool isLocal) {
     int n = function->numUpvalues;
 
     for( int i = 0; i < n; i++ ){
@@ -108,7 +131,8 @@ int Environment::addUpvalue(Compiler * c, uint8_t index, bool isConst, bool isLo
         return 0;
     }
 
-    upvalues[n] = {.index=index, .isConst=isConst, .isLocal=isLocal};
+    upvalues[n] = {.name=name, .index=index, .isConst=isConst, .isLocal=isLocal};
+    if( isLocal ) enclosing->locals[index].numCaptures++;
     return function->numUpvalues++;
 }
 
@@ -121,7 +145,12 @@ void Environment::endScope(Compiler * c) {
 
     // pop all locals which have fallen out of scope:
     while( localCount > 0 && locals[localCount-1].depth > scopeDepth ){
-        if( locals[localCount-1].isCaptured ){
+        Local & local = locals[localCount-1];
+        if( local.closureOffset != -1 && !local.isEscaping ){
+            // Only ever called, so the function's captures can stay on the stack:
+            c->stackClosure_(*this, local);
+        }
+        if( local.numCaptures > 0 ){
             c->emitByte_(OpCode::CLOSE_UPVALUE);
         }else{
             c->emitByte_(OpCode::POP);
@@ -130,8 +159,11 @@ void Environment::endScope(Compiler * c) {
     }
 }
 
-Compiler::Compiler(Mem * mem) : mem_(mem) {
+Compiler::Compiler(Mem * mem, Options const & options) : mem_(mem), options_(options) {
     name_ = nullptr;
+    source_ = nullptr;
+    path_ = nullptr;
+    sourceStream_ = nullptr;
 }
 
 Compiler::~Compiler() {
@@ -143,8 +175,26 @@ ObjFunction * Compiler::compile(const char * name, InputStream * stream) {
     // Capture the name of the script
     name_ = ObjString::newString(mem_, name);
 
+    if( options_.lazy ){
+        // Keep the whole script, so function bodies can be scanned again when first called
+        size_t length;
+        char const * buffer = stream->getBuffer(length);
+        std::vector<char> text;
+        if( buffer == nullptr ){
+            for( char c = stream->next(); c != '\0'; c = stream->next() ){
+                text.push_back(c);
+            }
+            buffer = text.data();
+            length = text.size();
+        }
+        source_ = ObjString::newString(mem_, buffer, (int)length);
+        if( stream->getPath() ) path_ = ObjString::newString(mem_, stream->getPath());
+        sourceStream_ = new StringInputStream(source_->getCString(), stream->getPath());
+        stream = sourceStream_;
+    }
+
     // Start the scanner
-    scanner_.init(mem_, stream);
+    scanner_.init(stream);
 
     Environment env(mem_, name_, Environment::SCRIPT);
     initEnvironment_(env);
@@ -163,9 +213,54 @@ ObjFunction * Compiler::compile(const char * name, InputStream * stream) {
     }
 
     ObjFunction * function = endEnvironment_();
+
+    delete sourceStream_;
+    sourceStream_ = nullptr;
     return hadError_ ? nullptr : function;
 }
 
+bool Compiler::compileLazy(ObjFunction * function) {
+    LazySource * lazy = function->lazy;
+    currentEnv_ = nullptr;
+    name_ = function->name;
+    source_ = lazy->script;
+    path_ = lazy->path;
+
+    // Resume scanning just after the '(' of the parameters:
+    StringInputStream stream(source_->getCString(), path_ ? path_->getCString() : nullptr);
+    sourceStream_ = &stream;
+    scanner_.init(&stream, lazy->line, lazy->col, lazy->offset);
+    currentToken_ = Token(Token::LEFT_PAREN, lazy->line, lazy->col);
+
+    // The function's upvalues were found by the scan:
+    Environment env(mem_, function, Environment::FUNCTION);
+    env.enclosing = nullptr;
+    currentEnv_ = &env;
+    for( size_t i = 0; i < lazy->upvalues.size(); ++i ){
+        env.upvalues[i] = {.name=lazy->upvalues[i].name, .index=0, .isConst=lazy->upvalues[i].isConst, .isLocal=false};
+    }
+
+    hadError_ = false;
+    hadFatalError_ = false;
+    panicMode_ = false;
+
+    functionBody_(env);
+    endEnvironment_();
+
+    sourceStream_ = nullptr;
+    if( hadError_ ){
+        // Leave the function as the scan left it, rather than with part of a body:
+        function->chunk.truncate(0, 0);
+        function->numInputs = 0;
+        function->isGenerator = false;
+        return false;
+    }
+
+    function->lazy = nullptr;
+    delete lazy;
+    return true;
+}
+
 void Compiler::gcMarkRoots() {
     // Iterate up through nested environments, marking objects as in use
     Environment * env = currentEnv_;
@@ -184,6 +279,14 @@ void Compiler::gcMarkRoots() {
 
     // Mark the script name, once provided
     if( name_ ) name_->gcMark();
+    if( source_ ) source_->gcMark();
+    if( path_ ) path_->gcMark();
+
+    // Functions which later calls may inline
+    for( auto & entry : globalFunctions_ ){
+        entry.first->gcMark();
+        entry.second->gcMark();
+    }
 
     if( currentToken_.string ) currentToken_.string->gcMark();
     if( previousToken_.string ) previousToken_.string->gcMark();
@@ -197,10 +300,31 @@ void Compiler::initEnvironment_(Environment & env) {
 ObjFunction * Compiler::endEnvironment_() {
     emitReturn_();
     ObjFunction * fn = currentEnv_->function;
+    if( options_.optimise && !hadError_ ){
+        Optimiser optimiser;
+        optimiser.optimise(&fn->chunk);
+    }
+    // Wait for the outermost function, as enclosing functions can still change nested ones:
+    if( options_.disassemble && !hadError_ && currentEnv_->enclosing == nullptr ){
+        disassemble_(fn);
+        // flush before the vm starts writing to stdout directly:
+        fflush(stdout);
+    }
     currentEnv_ = currentEnv_->enclosing;
     return fn;
 }
 
+void Compiler::disassemble_(ObjFunction * fn) {
+    for( int i = 0; i < fn->chunk.numLiterals(); i++ ){
+        Value literal = fn->chunk.getLiteral((uint32_t)i);
+        if( literal.isFunction() && literal.asObjFunction()->lazy == nullptr ){
+            disassemble_(literal.asObjFunction());
+        }
+    }
+    Disassembler disasm;
+    disasm.disassembleChunk(&fn->chunk, fn->name->get());
+}
+
 void Compiler::advance_() {
     // record last token
     previousToken_ = currentToken_;
@@ -216,7 +340,7 @@ void Compiler::advance_() {
 
         if( currentToken_.type == Token::ERROR ){
             // report error then ignore and continue
-            errorAtCurrent_(currentToken_.string->getCString());
+            errorAtCurrent_("%s", currentToken_.message);
         }else{
             // valid token
             return;
@@ -224,6 +348,18 @@ void Compiler::advance_() {
     }
 }
 
+ObjString * Compiler::tokenString_(Token & token) {
+    // Interned on first use, and kept with the token to protect it from garbage collection
+    if( token.string == nullptr ){
+        token.string = ObjString::newString(mem_, scanner_.getChars(token), (int)token.length);
+    }
+    return token.string;
+}
+
+double Compiler::tokenNumber_(Token const & token) {
+    return Number::parse(scanner_.getChars(token), (int)token.length);
+}
+
 bool Compiler::check_(Token::Type type) {
     return currentToken_.type == type;
 }
@@ -275,15 +411,15 @@ void Compiler::emitReturn_() {
 }
 
 void Compiler::emitTrue_() {
-    emitByte_(OpCode::TRUE);
+    emitConstant_(Value::boolean(true));
 }
 
 void Compiler::emitFalse_() {
-    emitByte_(OpCode::FALSE);
+    emitConstant_(Value::boolean(false));
 }
 
 void Compiler::emitNil_() {
-    emitByte_(OpCode::NIL);
+    emitConstant_(Value::nil());
 }
 
 void Compiler::emitBoolType_() {
@@ -307,11 +443,118 @@ void Compiler::emitTypeIdType_() {
 }
 
 void Compiler::emitLiteral_(Value value) {
-    emitBytes_(OpCode::LITERAL, makeLiteral_(value));
+    emitLiteralOp_(OpCode::LITERAL, makeLiteral_(value));
+}
+
+void Compiler::emitConstant_(Value value) {
+    int start = getCurrentChunk_()->count();
+    int numLiterals = getCurrentChunk_()->numLiterals();
+    switch( value.type ){
+        case Value::NIL:    emitByte_(OpCode::NIL); break;
+        case Value::BOOL:   emitByte_(value.as.boolean ? OpCode::TRUE : OpCode::FALSE); break;
+        case Value::NUMBER:
+            // simplify operation for common values (-0 has to stay a literal):
+            if( value.as.number == 0 && !signbit(value.as.number) ){
+                emitByte_(OpCode::PUSH_ZERO);
+            }else if( value.as.number == 1 ){
+                emitByte_(OpCode::PUSH_ONE);
+            }else{
+                emitLiteral_(value);
+            }
+            break;
+        default:            emitLiteral_(value); break;
+    }
+    setLatestExpression_(start, numLiterals, true, value.isNumber(), value);
+}
+
+EmittedExpression Compiler::latestExpression_() {
+    Chunk * chunk = getCurrentChunk_();
+    if( latest_.chunk != chunk || latest_.end != chunk->count() ){
+        // something else has been emitted since
+        return EmittedExpression();
+    }
+    return latest_;
+}
+
+void Compiler::setLatestExpression_(int start, int numLiterals, bool isConstant, bool isNumber, Value value) {
+    latest_.chunk = getCurrentChunk_();
+    latest_.start = start;
+    latest_.numLiterals = numLiterals;
+    latest_.end = latest_.chunk->count();
+    latest_.isConstant = isConstant;
+    latest_.isNumber = isNumber;
+    latest_.value = value;
+}
+
+void Compiler::discardFrom_(EmittedExpression const & expr) {
+    // literals added since the expression started can only be used by the discarded code:
+    getCurrentChunk_()->truncate(expr.start, expr.numLiterals);
+}
+
+bool Compiler::foldBinary_(uint8_t opCode, Value a, Value b, Value & result) {
+    // equality is defined for every constant:
+    if( opCode == OpCode::EQUAL ){
+        result = Value::boolean(a.equals(b));
+        return true;
+    }
+    if( opCode == OpCode::NOT_EQUAL ){
+        result = Value::boolean(!a.equals(b));
+        return true;
+    }
+
+    // string concatenation, with the same conversion as the vm:
+    if( opCode == OpCode::ADD && a.isString() ){
+        if( b.isString() ){
+            result = Value::string(ObjString::concatenate(mem_, a.asObjString(), b.asObjString()));
+            return true;
+        }
+        if( b.isNumber() ){
+            result = Value::string(ObjString::concatenate(mem_, a.asObjString(), b.as.number));
+            return true;
+        }
+        return false;
+    }
+
+    // leave anything which is a runtime error to the vm:
+    if( !a.isNumber() || !b.isNumber() ) return false;
+    double x = a.as.number;
+    double y = b.as.number;
+    switch( opCode ){
+        case OpCode::ADD:           result = Value::number(x + y); return true;
+        case OpCode::SUBTRACT:      result = Value::number(x - y); return true;
+        case OpCode::MULTIPLY:      result = Value::number(x * y); return true;
+        case OpCode::DIVIDE:        result = Value::number(x / y); return true;
+        case OpCode::GREATER:       result = Value::boolean(x > y); return true;
+        case OpCode::GREATER_EQUAL: result = Value::boolean(x >= y); return true;
+        case OpCode::LESS:          result = Value::boolean(x < y); return true;
+        case OpCode::LESS_EQUAL:    result = Value::boolean(x <= y); return true;
+        default:                    return false;
+    }
 }
 
-uint8_t Compiler::makeLiteral_(Value value) {
-    uint8_t literal = getCurrentChunk_()->addLiteral(value);
+void Compiler::emitLiteralOp_(uint8_t op, uint32_t literal) {
+    if( literal <= UINT8_MAX ){
+        emitBytes_(op, (uint8_t)literal);
+        return;
+    }
+    // index doesn't fit in a byte, use the 3 byte form of the instruction:
+    switch( op ){
+        case OpCode::LITERAL:             op = OpCode::LITERAL_LONG; break;
+        case OpCode::CLOSURE:             op = OpCode::CLOSURE_LONG; break;
+        case OpCode::DEFINE_GLOBAL_VAR:   op = OpCode::DEFINE_GLOBAL_VAR_LONG; break;
+        case OpCode::DEFINE_GLOBAL_CONST: op = OpCode::DEFINE_GLOBAL_CONST_LONG; break;
+        case OpCode::GET_GLOBAL:          op = OpCode::GET_GLOBAL_LONG; break;
+        case OpCode::SET_GLOBAL:          op = OpCode::SET_GLOBAL_LONG; break;
+        default: assert(false && "Instruction has no long form"); break;
+    }
+    emitByte_(op);
+    emitByte_((uint8_t)((literal >> 16) & 0xFF));
+    emitByte_((uint8_t)((literal >> 8) & 0xFF));
+    emitByte_((uint8_t)(literal & 0xFF));
+}
+
+uint32_t Compiler::makeLiteral_(Value value) {
+    uint32_t literal = getCurrentChunk_()->addLiteral(value);
     if( literal == Chunk::MAX_LITERALS ){
         errorAtPrevious_("Too many literals in one chunk.");
         return 0;
@@ -349,17 +592,29 @@ void Compiler::funcDeclaration_() {
     bool isConst = true;  // Disallow redefining functions
 
     // Load the function variable name, getting the literals index (if global) or 0 (if local):
-    uint8_t global = parseVariable_("Expected function name.", isConst, isLocal);
+    uint32_t global = parseVariable_("Expected function name.", isConst, isLocal);
 
     // capture function name for the environment too:
-    ObjString * name = previousToken_.string;
+    ObjString * name = previousToken_.type == Token::IDENTIFIER ? previousToken_.string : mem_->EMPTY_STRING;
 
     // If its a local, mark it as already defined (allowing for self-referential functions):
     // This is not an issue for globals
-    if( isLocal ) currentEnv_->defineLocal();
+    int local = -1;
+    if( isLocal ){
+        local = currentEnv_->defineLocal();
+        // the CLOSURE comes first, the function body goes into its own chunk:
+        currentEnv_->locals[local].closureOffset = getCurrentChunk_()->count();
+    }
 
     // parse arguments and function content
-    function_(name, Environment::FUNCTION);
+    ObjFunction * fn = function_(name, Environment::FUNCTION);
+
+    // remember the function so calls to it can be inlined
+    if( isLocal ){
+        currentEnv_->locals[local].function = fn;
+    }else{
+        globalFunctions_[name] = fn;
+    }
 
     // assign function literal to variable
     defineVariable_(global, isConst, isLocal);
@@ -370,10 +625,66 @@ void Compiler::funcAnonymous_() {
     function_(mem_->EMPTY_STRING, Environment::FUNCTION);
 }
 
-void Compiler::function_(ObjString * name, Environment::Type type) {
+void Compiler::stackClosure_(Environment & env, Local & local) {
+    Chunk * chunk = &env.function->chunk;
+    uint8_t * closure = chunk->getCode() + local.closureOffset;
+    // There is no long form of CLOSURE_STACK, so a function beyond the first 256 literals keeps its upvalues:
+    if( closure[0] != OpCode::CLOSURE ) return;
+
+    ObjFunction * fn = chunk->getLiteral(closure[1]).asObjFunction();
+    if( fn->lazy != nullptr || fn->numUpvalues == 0 ) return;
+
+    // A generator's frame moves each time it resumes, and a generator made by the closure can outlive it:
+    if( env.function->isGenerator || fn->isGenerator ) return;
+
+    // Can only read this frame's slots, not the upvalues of an enclosing function:
+    uint8_t * captures = closure + 2;
+    for( int i = 0; i < fn->numUpvalues; i++ ){
+        if( !captures[2*i] ) return;
+    }
+
+    Optimiser optimiser;
+    if( !optimiser.useEnclosingSlots(&fn->chunk, captures) ) return;
+    closure[0] = OpCode::CLOSURE_STACK;
+
+    // The locals it captured don't need closing on its account any more:
+    for( int i = 0; i < fn->numUpvalues; i++ ){
+        env.locals[captures[2*i + 1]].numCaptures--;
+    }
+}
+
+ObjFunction * Compiler::function_(ObjString * name, Environment::Type type) {
     // new environment
     Environment env(mem_, name, type);
     initEnvironment_(env);
+
+    ObjFunction * fn;
+    if( options_.lazy && check_(Token::LEFT_PAREN) ){
+        scanFunctionBody_(env);
+        // Skip endEnvironment_(), there is no code yet:
+        fn = env.function;
+        currentEnv_ = env.enclosing;
+    }else{
+        functionBody_(env);
+        fn = endEnvironment_();
+    }
+
+    // New function literal:
+    uint32_t literal = makeLiteral_(Value::function(fn));
+    // Note: CLOSURE instruction takes a function literal and wraps it to make a Closure
+    emitLiteralOp_(OpCode::CLOSURE, literal);
+
+    // List all the upvalues (variables enclosed by function):
+    for( int i = 0; i < fn->numUpvalues; i++ ){
+        // track whether it is a local or already an upvalue which is being uplifted:
+        emitByte_(env.upvalues[i].isLocal ? 1 : 0);
+        // stack position of value to lift:
+        emitByte_(env.upvalues[i].index);
+    }
+    return fn;
+}
+
+void Compiler::functionBody_(Environment & env) {
     env.beginScope();
 
     // (i.e. function as expression)
@@ -407,19 +718,77 @@ void Compiler::function_(ObjString * name, Environment::Type type) {
     // Note: no actual need to endScope(), as we are done with the Environment now
     // call it so that we can check the stack emptied correctly:
     env.endScope(this);
+}
 
-    // New function literal:
-    ObjFunction * fn = endEnvironment_();
-    uint8_t literal = makeLiteral_(Value::function(fn));
-    // Note: CLOSURE instruction takes a function literal and wraps it to make a Closure
-    emitBytes_(OpCode::CLOSURE, literal);
+void Compiler::scanFunctionBody_(Environment & env) {
+    // Remember where the body starts, so it can be compiled when first called:
+    LazySource * lazy = new LazySource();
+    lazy->script = source_;
+    lazy->path = path_;
+    lazy->offset = scanner_.getOffset();
+    lazy->line = currentToken_.line;
+    lazy->col = currentToken_.col;
+    env.function->lazy = lazy;
 
-    // List all the upvalues (variables enclosed by function):
-    for( int i = 0; i < fn->numUpvalues; i++ ){
-        // track whether it is a local or already an upvalue which is being uplifted:
-        emitByte_(env.upvalues[i].isLocal ? 1 : 0);
-        // stack position of value to lift:
-        emitByte_(env.upvalues[i].index);
+    // The parameters are declared in the body:
+    std::vector<ScannedName> declared;
+    consume_(Token::LEFT_PAREN, "Expected '(' for function.");
+    while( !check_(Token::RIGHT_PAREN) && !check_(Token::END) ){
+        if( match_(Token::IDENTIFIER) ){
+            declared.push_back({tokenString_(previousToken_), 1});
+        }else{
+            advance_();
+        }
+    }
+    consume_(Token::RIGHT_PAREN, "Expected ')' after parameters.");
+    consume_(Token::LEFT_BRACE, "Expected '{' before function body.");
+
+    // Any other identifier in the body (including nested functions) might refer to an enclosing local,
+    // unless the body has declared that name itself by then:
+    int depth = 1;
+    while( depth > 0 && !check_(Token::END) ){
+        if( match_(Token::LEFT_BRACE) ){
+            depth++;
+        }else if( match_(Token::RIGHT_BRACE) ){
+            depth--;
+            while( !declared.empty() && declared.back().depth > depth ){
+                declared.pop_back();
+            }
+        }else if( match_(Token::VAR) || match_(Token::CONST) ){
+            if( match_(Token::IDENTIFIER) ) declared.push_back({tokenString_(previousToken_), depth});
+        }else if( match_(Token::FOR) ){
+            // the iterator belongs to the loop's block:
+            if( match_(Token::IDENTIFIER) ) declared.push_back({tokenString_(previousToken_), depth + 1});
+        }else if( match_(Token::FN) ){
+            // a nested function's parameters belong to its body:
+            if( match_(Token::IDENTIFIER) ) declared.push_back({tokenString_(previousToken_), depth});
+            if( match_(Token::LEFT_PAREN) ){
+                while( !check_(Token::RIGHT_PAREN) && !check_(Token::END) ){
+                    if( match_(Token::IDENTIFIER) ){
+                        declared.push_back({tokenString_(previousToken_), depth + 1});
+                    }else{
+                        advance_();
+                    }
+                }
+            }
+        }else if( match_(Token::IDENTIFIER) ){
+            ObjString * name = tokenString_(previousToken_);
+            bool isDeclared = false;
+            for( ScannedName const & scanned : declared ){
+                if( scanned.name == name ) isDeclared = true;
+            }
+            bool isConst;
+            if( !isDeclared ) env.resolveUpvalue(this, name, isConst);
+        }else{
+            advance_();
+        }
+    }
+    if( depth > 0 ){
+        errorAtCurrent_("Expected '}' after block.");
+    }
+
+    for( int i = 0; i < env.function->numUpvalues; ++i ){
+        lazy->upvalues.push_back({env.upvalues[i].name, env.upvalues[i].isConst});
     }
 }
 
@@ -428,7 +797,7 @@ void Compiler::varDeclaration_(bool isConst) {
     bool isLocal = currentEnv_->scopeDepth > 0;
 
     // Load the variable name, getting the literals index (if global) or 0 (if local):
-    uint8_t global = parseVariable_("Expected variable name.", isConst, isLocal);
+    uint32_t global = parseVariable_("Expected variable name.", isConst, isLocal);
 
     // assigned an initial value?
     if( match_(Token::EQUAL) ){
@@ -441,9 +810,12 @@ void Compiler::varDeclaration_(bool isConst) {
     defineVariable_(global, isConst, isLocal);
 }
 
-uint8_t Compiler::parseVariable_(const char * errorMsg, bool isConst, bool isLocal) {
+uint32_t Compiler::parseVariable_(const char * errorMsg, bool isConst, bool isLocal) {
     // the name of the variable:
     consume_( Token::IDENTIFIER, errorMsg );
+    if( previousToken_.type != Token::IDENTIFIER ){
+        return 0;  // error already reported, and there is no name to use
+    }
 
     if(isLocal) {
         // local variables are registered to the stack
@@ -451,13 +823,13 @@ uint8_t Compiler::parseVariable_(const char * errorMsg, bool isConst, bool isLoc
         return 0; // not a global
     } else {
         // globals variables have their names stored as a literal:
-        return makeIdentifierLiteral_(previousToken_.string);
+        return makeIdentifierLiteral_(tokenString_(previousToken_));
     }
 }
 
 void Compiler::declareLocal_(bool isConst) {
     // the name of the new local variable:
-    ObjString * name = previousToken_.string;
+    ObjString * name = tokenString_(previousToken_);
 
     // ensure the variable is not already declared in this scope!
     for( int i = currentEnv_->localCount-1; i>=0; i-- ){
@@ -477,13 +849,13 @@ void Compiler::declareLocal_(bool isConst) {
     }
 }
 
-void Compiler::defineVariable_(uint8_t global, bool isConst, bool isLocal) {
+void Compiler::defineVariable_(uint32_t global, bool isConst, bool isLocal) {
     if( isLocal ){
         currentEnv_->defineLocal();
     }else if( isConst ){
-        emitBytes_(OpCode::DEFINE_GLOBAL_CONST, global);
+        emitLiteralOp_(OpCode::DEFINE_GLOBAL_CONST, global);
     }else{
-        emitBytes_(OpCode::DEFINE_GLOBAL_VAR, global);
+        emitLiteralOp_(OpCode::DEFINE_GLOBAL_VAR, global);
     }
 }
 
@@ -517,6 +889,10 @@ bool Compiler::statement_(bool canBeExpression) {
         forStatement_();
         return false;  // statement only (for now!)
 
+    }else if( match_(Token::SWITCH) ){
+        switchStatement_();
+        return false;
+
     }else if( match_(Token::LEFT_BRACE) ){
         // recurse into a nested scope:
         return nestedBlock_(canBeExpression);
@@ -532,6 +908,19 @@ bool Compiler::statement_(bool canBeExpression) {
             expression_();
             emitByte_(OpCode::RETURN);
         }
+    }else if( match_(Token::YIELD) ){
+        if( currentEnv_->type == Environment::SCRIPT ){
+            errorAtPrevious_("Can't yield from top-level.");
+        }
+        // calling the function now makes a generator:
+        currentEnv_->function->isGenerator = true;
+        if( check_(Token::SEMICOLON) ){
+            emitByte_(OpCode::NIL);
+        }else{
+            expression_();
+        }
+        // the yielded value is still on the stack when resumed, as the statement's result
+        emitByte_(OpCode::YIELD);
     }else if( match_(Token::SEMICOLON) ){
         // Empty statement
         return false;
@@ -657,9 +1046,9 @@ void Compiler::forStatement_() {
     // The initial value (or the end value if there is no range separator)
     expression_();
     uint8_t iteratorLocal = currentEnv_->defineLocal();
+    bool inclusiveRange = check_(Token::COLON_EQUAL);
 
     // Ranges are denoted by : or := (indicating exclusive and inclusive of end value)
-    bool inclusiveRange = check_(Token::COLON_EQUAL);
     if( match_(Token::COLON) || match_(Token::COLON_EQUAL) ){
         // Evaluate the end value.
         expression_();
@@ -679,39 +1068,215 @@ void Compiler::forStatement_() {
         emitByte_(OpCode::POP);  // Remove the zero
     }
 
-    // Remember where to loop back to
+    // The end value, and the step which FOR_PREP pushes, are unnamed locals after the iterator:
+    addHiddenLocal_();
+    emitBytes_(inclusiveRange ? OpCode::FOR_PREP_INCLUSIVE : OpCode::FOR_PREP, iteratorLocal);
+    emitBytes_(0xFF, 0xFF);  // placeholder jump, as emitJump_
+    int jumpToEnd = getCurrentChunk_()->count() - 2;
+    addHiddenLocal_();
+
     int loopStart = getCurrentChunk_()->count();
+    nestedBlock_(false);
 
-    // To include the final value, do the body before the check
-    if( inclusiveRange ) nestedBlock_(false);
+    // Step the iterator and loop back, all in one:
+    emitBytes_(OpCode::FOR_STEP, iteratorLocal);
+    int offset = getCurrentChunk_()->count() - loopStart + 2;
+    if( offset > UINT16_MAX ) errorAtPrevious_("Loop body is too large.");
+    emitBytes_((uint8_t)((offset >> 8) & 0xff), (uint8_t)(offset & 0xff));
 
-    // Compare iterator to end value and put +1, -1 or 0 on the stack
-    // This is used both to check when to exit and for the iteration direction
-    emitByte_(OpCode::COMPARE_ITERATOR);
-    int jumpToEnd = emitJump_(OpCode::JUMP_IF_ZERO);
+    // This is where we exit
+    setJumpDestination_(jumpToEnd);
 
-    // To exclude the final value, we do the body after the check
-    if( !inclusiveRange ) nestedBlock_(false);
+    // Pop the loop variable, end value and step
+    currentEnv_->endScope(this);
+}
 
-    // Add the compare value to the iterator:
-    emitBytes_(OpCode::GET_LOCAL, iteratorLocal);
-    emitByte_(OpCode::ADD);
-    emitBytes_(OpCode::SET_LOCAL, iteratorLocal);
-    emitByte_(OpCode::POP);  // Clean up the new loop value
+void Compiler::switchStatement_() {
+    // Scope for the value switched on, kept as an unnamed local while the cases run
+    currentEnv_->beginScope();
+    expression_();
+    addHiddenLocal_();
+    uint8_t valueLocal = (uint8_t)(currentEnv_->localCount - 1);
+    consume_(Token::LEFT_BRACE, "Expected '{' after switch value.");
 
-    // Loop back 
-    emitLoop_(loopStart);
+    // The bodies come first, and the dispatch to them after, once all the case values are known:
+    int jumpToDispatch = emitJump_(OpCode::JUMP);
 
-    // This is where we exit
-    setJumpDestination_(jumpToEnd);
+    std::vector<SwitchCase> cases;
+    std::vector<int> jumpsToEnd;
+    int defaultBody = -1;
+    bool isValid = true;
+    while( isValid && !check_(Token::RIGHT_BRACE) && !check_(Token::END) ){
+        int body = getCurrentChunk_()->count();
+        if( match_(Token::STAR) ){
+            if( defaultBody != -1 ) errorAtPrevious_("Already a default case in this switch.");
+            defaultBody = body;
+        }else{
+            // one or more values separated by commas:
+            do{
+                Value value;
+                if( !caseValue_(value) ){
+                    isValid = false;
+                    break;
+                }
+                for( SwitchCase & other : cases ){
+                    if( other.value.equals(value) ) errorAtPrevious_("Already a case for this value.");
+                }
+                cases.push_back({value, body});
+            }while( match_(Token::COMMA) );
+            if( !isValid ) break;
+        }
+        consume_(Token::LEFT_BRACE, "Expected '{' after case.");
+        nestedBlock_(false);
+        jumpsToEnd.push_back(emitJump_(OpCode::JUMP));
+    }
+    consume_(Token::RIGHT_BRACE, "Expected '}' after switch cases.");
 
-    emitByte_(OpCode::POP);  // Clean up the compare value
-    emitByte_(OpCode::POP);  // Clean up the end value
+    setJumpDestination_(jumpToDispatch);
+    bool allStrings = !cases.empty();
+    for( SwitchCase & c : cases ){
+        if( !c.value.isString() ) allStrings = false;
+    }
+    if( allStrings ){
+        emitStringSwitch_(cases, defaultBody);
+    }else if( !emitJumpTable_(cases, defaultBody) ){
+        emitCaseTests_(cases, defaultBody, valueLocal);
+    }
+
+    for( int jump : jumpsToEnd ){
+        setJumpDestination_(jump);
+    }
 
-    // Pop the loop variable
+    // Pop the switch value
     currentEnv_->endScope(this);
 }
 
+bool Compiler::caseValue_(Value & value) {
+    bool isNegative = match_(Token::MINUS);
+    if( isNegative ){
+        consume_(Token::NUMBER, "Expected a number after '-'.");
+        if( previousToken_.type != Token::NUMBER ) return false;
+    }
+    if( isNegative || match_(Token::NUMBER) ){
+        double n = tokenNumber_(previousToken_);
+        value = Value::number(isNegative ? -n : n);
+    }else if( match_(Token::STRING) ){
+        value = Value::string(tokenString_(previousToken_));
+        makeLiteral_(value);  // keeps the string from being collected while the bodies compile
+    }else if( match_(Token::TRUE) || match_(Token::FALSE) ){
+        value = Value::boolean(previousToken_.type == Token::TRUE);
+    }else if( match_(Token::NIL) ){
+        value = Value::nil();
+    }else{
+        errorAtCurrent_("Expected a number, string, true, false, nil or '*' for case.");
+        return false;
+    }
+    return true;
+}
+
+bool Compiler::emitJumpTable_(std::vector<SwitchCase> const & cases, int defaultBody) {
+    // Only for whole numbers close enough together that most of the table is used:
+    if( cases.empty() ) return false;
+    double min = cases[0].value.isNumber() ? cases[0].value.as.number : 0;
+    double max = min;
+    for( SwitchCase const & c : cases ){
+        if( !c.value.isNumber() ) return false;
+        double n = c.value.as.number;
+        if( n != floor(n) || n < INT16_MIN || n > INT16_MAX ) return false;
+        if( n < min ) min = n;
+        if( n > max ) max = n;
+    }
+    int count = (int)(max - min) + 1;
+    if( count > (int)cases.size() * (JUMP_TABLE_MAX_HOLES + 1) ) return false;
+
+    // JUMP_TABLE min count, followed by a jump for each value from min and one for anything else:
+    emitByte_(OpCode::JUMP_TABLE);
+    uint16_t encodedMin = (uint16_t)(int16_t)min;
+    emitBytes_((uint8_t)(encodedMin >> 8), (uint8_t)(encodedMin & 0xFF));
+    emitBytes_((uint8_t)(count >> 8), (uint8_t)(count & 0xFF));
+
+    std::vector<int> targets((size_t)count, defaultBody);
+    for( SwitchCase const & c : cases ){
+        targets[(size_t)(c.value.as.number - min)] = c.body;
+    }
+    targets.push_back(defaultBody);
+
+    int end = getCurrentChunk_()->count() + 3 * (count + 1);
+    for( int target : targets ){
+        emitSwitchEntry_(target, end);
+    }
+    return true;
+}
+
+void Compiler::emitStringSwitch_(std::vector<SwitchCase> const & cases, int defaultBody) {
+    // Open addressed hash table of case numbers, at most half full, indexed by the interned strings' hashes:
+    int bits = 1;
+    while( (1 << bits) < 2 * (int)cases.size() ) bits++;
+    int mask = (1 << bits) - 1;
+    std::vector<uint16_t> table((size_t)(1 << bits), UINT16_MAX);
+    for( size_t i = 0; i < cases.size(); ++i ){
+        uint32_t slot = cases[i].value.asObjString()->getHash() & (uint32_t)mask;
+        while( table[slot] != UINT16_MAX ) slot = (slot + 1) & (uint32_t)mask;
+        table[slot] = (uint16_t)i;
+    }
+
+    // SWITCH_STRING count bits table literals, followed by a jump for each case and one for anything else:
+    int count = (int)cases.size();
+    if( count >= UINT16_MAX ){
+        errorAtPrevious_("Too many cases in switch.");
+        return;
+    }
+    emitByte_(OpCode::SWITCH_STRING);
+    emitBytes_((uint8_t)(count >> 8), (uint8_t)(count & 0xFF));
+    emitByte_((uint8_t)bits);
+    for( uint16_t c : table ){
+        emitBytes_((uint8_t)(c >> 8), (uint8_t)(c & 0xFF));
+    }
+    for( SwitchCase const & c : cases ){
+        uint32_t literal = makeLiteral_(c.value);
+        emitByte_((uint8_t)(literal >> 16));
+        emitBytes_((uint8_t)((literal >> 8) & 0xFF), (uint8_t)(literal & 0xFF));
+    }
+
+    int end = getCurrentChunk_()->count() + 3 * (count + 1);
+    for( SwitchCase const & c : cases ){
+        emitSwitchEntry_(c.body, end);
+    }
+    emitSwitchEntry_(defaultBody, end);
+}
+
+void Compiler::emitCaseTests_(std::vector<SwitchCase> const & cases, int defaultBody, uint8_t valueLocal) {
+    // Compare with each value in turn:
+    for( SwitchCase const & c : cases ){
+        emitBytes_(OpCode::GET_LOCAL, valueLocal);
+        emitLiteral_(c.value);
+        emitByte_(OpCode::EQUAL);
+        int jumpOver = emitJump_(OpCode::JUMP_IF_FALSE_POP);
+        emitLoop_(c.body);
+        setJumpDestination_(jumpOver);
+    }
+    if( defaultBody != -1 ) emitLoop_(defaultBody);
+}
+
+void Compiler::emitSwitchEntry_(int target, int end) {
+    if( target != -1 ){
+        emitLoop_(target);
+        return;
+    }
+    int distance = end - (getCurrentChunk_()->count() + 3);
+    emitByte_(OpCode::JUMP);
+    emitBytes_((uint8_t)(distance >> 8), (uint8_t)(distance & 0xFF));
+}
+
+void Compiler::addHiddenLocal_() {
+    // the empty name can't be referenced
+    if( !currentEnv_->addLocal(mem_->EMPTY_STRING, true) ){
+        errorAtPrevious_("Too many local variables in function.");
+        return;
+    }
+    currentEnv_->defineLocal();
+}
+
 void Compiler::synchronise_() {
     // don't stop panicking if we have had a fatal error: 
     if( hadFatalError_ ) return;
@@ -730,6 +1295,7 @@ void Compiler::synchronise_() {
             case Token::FOR:
             case Token::IF:
             case Token::WHILE:
+            case Token::SWITCH:
             case Token::PRINT:
             case Token::ECHO:
             case Token::RETURN:
@@ -790,7 +1356,7 @@ void Compiler::parse_(Precedence precedence) {
         }
         // Consume and then compile the operator:
         advance_();
-        infixOperation_(type);
+        infixOperation_(type, canAssign);
     }
     // Handle a case where assignment is badly placed, otherwise this isn't handled!
     if( canAssign && match_(Token::EQUAL) ){
@@ -798,7 +1364,7 @@ void Compiler::parse_(Precedence precedence) {
     }
 }
 
-uint8_t Compiler::makeIdentifierLiteral_(ObjString * name) {
+uint32_t Compiler::makeIdentifierLiteral_(ObjString * name) {
     return makeLiteral_(Value::string(name));
 }
 
@@ -813,6 +1379,8 @@ int Compiler::emitJump_(uint8_t instr) {
 
 void Compiler::setJumpDestination_(int offset) {
     Chunk * chunk = getCurrentChunk_();
+    // code can now be reached by jumping here, so must not be folded into anything before it:
+    latest_ = EmittedExpression();
 
     // how far to jump:
     int jumpLen = chunk->count() - offset - 2;
@@ -846,12 +1414,37 @@ void Compiler::unary_() {
     uint16_t line = previousToken_.line;
 
     // Compile the operand evaluation first:
+    int start = getCurrentChunk_()->count();
+    int numLiterals = getCurrentChunk_()->numLiterals();
     parse_(Precedence::UNARY);
 
+    // Evaluate now if the operand is a constant:
+    EmittedExpression operand = latestExpression_();
+    if( operand.isConstant ){
+        Value value = operand.value;
+        bool canFold = false;
+        if( operatorType == Token::BANG ){
+            // only nil and false are falsey:
+            value = Value::boolean(value.isNil() || (value.isBoolean() && !value.as.boolean));
+            canFold = true;
+        }else if( operatorType == Token::MINUS && value.isNumber() ){
+            value = Value::number(-value.as.number);
+            canFold = true;
+        }
+        if( canFold ){
+            discardFrom_(operand);
+            emitConstant_(value);
+            return;
+        }
+    }
+
     // Result of the operand gets negated:
     switch( operatorType ){
         case Token::BANG:  emitByteAtLine_(OpCode::NOT, line); break;
-        case Token::MINUS: emitByteAtLine_(OpCode::NEGATE, line); break;
+        case Token::MINUS:
+            emitByteAtLine_(OpCode::NEGATE, line);
+            setLatestExpression_(start, numLiterals, false, true, Value::nil());
+            break;
         default: break;
     }
 }
@@ -862,15 +1455,54 @@ void Compiler::binary_(uint8_t opCode) {
     Token::Type operatorType = previousToken_.type;
     int precedence = (int)getInfixPrecedence_(operatorType);
 
+    // the first operand might be a constant or known to be a number:
+    EmittedExpression lhs = latestExpression_();
+
     // parse the second operand, and stop when the precendence is equal or lower
     // stopping when precedence is equal causes math to be left associative: 1+2+3 = (1+2)+3
     parse_((Precedence)(precedence + 1));
+    EmittedExpression rhs = latestExpression_();
+    bool adjacent = lhs.end != -1 && rhs.end != -1 && rhs.start == lhs.end;
+
+    // both constant: evaluate now and replace both operands with the result
+    Value result;
+    if( adjacent && lhs.isConstant && rhs.isConstant
+            && foldBinary_(opCode, lhs.value, rhs.value, result) ){
+        discardFrom_(lhs);
+        emitConstant_(result);
+        return;
+    }
+
+    // operations which leave a number unchanged: x - 0, x * 1, x / 1
+    // NOTE: x + 0 is not one of them, as -0 + 0 is 0
+    if( adjacent && lhs.isNumber && rhs.isConstant && rhs.value.isNumber() ){
+        double n = rhs.value.as.number;
+        if( (opCode == OpCode::SUBTRACT && n == 0)
+                || (opCode == OpCode::ADD && n == 0 && signbit(n))
+                || ((opCode == OpCode::MULTIPLY || opCode == OpCode::DIVIDE) && n == 1) ){
+            discardFrom_(rhs);
+            setLatestExpression_(lhs.start, lhs.numLiterals, false, true, Value::nil());
+            return;
+        }
+    }
 
     // now both operand values will end up on the stack. emit the operation to combine theM
     emitByte_(opCode);
+
+    // arithmetic always results in a number (or a runtime error):
+    bool isNumber = opCode == OpCode::SUBTRACT || opCode == OpCode::MULTIPLY || opCode == OpCode::DIVIDE
+        || (opCode == OpCode::ADD && lhs.isNumber && rhs.isNumber);
+    if( isNumber ){
+        setLatestExpression_(lhs.start, lhs.numLiterals, false, true, Value::nil());
+    }
 }
 
 void Compiler::call_() {
+    uint8_t argCount = arguments_();
+    emitBytes_(OpCode::CALL, argCount);
+}
+
+uint8_t Compiler::arguments_() {
     // parse arguments:
     uint8_t argCount = 0;
     if( !check_(Token::RIGHT_PAREN) ) {
@@ -883,24 +1515,30 @@ void Compiler::call_() {
         } while( match_(Token::COMMA) );
     }
     consume_(Token::RIGHT_PAREN, "Expected ')' after arguments.");
-
-    emitBytes_(OpCode::CALL, argCount);
+    return argCount;
 }
 
 void Compiler::list_() {
-    uint8_t numEntries = 0;
+    // MAKE_LIST takes at most 255 values from the stack,
+    // so longer lists are made in batches which are concatenated
+    int numEntries = 0;  // in the current batch
+    bool isFirstBatch = true;
     if( !check_(Token::RIGHT_BRACKET) ) {
         do {
-            expression_();
-            if( numEntries == 255 ){
-                errorAtPrevious_("Can't have more than 255 elements in list initialiser.");
+            if( numEntries == UINT8_MAX ){
+                emitBytes_(OpCode::MAKE_LIST, UINT8_MAX);
+                if( !isFirstBatch ) emitByte_(OpCode::ADD);
+                isFirstBatch = false;
+                numEntries = 0;
             }
+            expression_();
             numEntries ++;
         } while( match_(Token::COMMA) );
     }
     consume_(Token::RIGHT_BRACKET, "Expected ']' after list elements.");
 
-    emitBytes_(OpCode::MAKE_LIST, numEntries);
+    emitBytes_(OpCode::MAKE_LIST, (uint8_t)numEntries);
+    if( !isFirstBatch ) emitByte_(OpCode::ADD);
 }
 
 void Compiler::type_() {
@@ -925,36 +1563,37 @@ void Compiler::echo_() {
     emitByte_(OpCode::ECHO);
 }
 
-void Compiler::index_() {
+void Compiler::index_(bool canAssign) {
     expression_();
     consume_(Token::RIGHT_BRACKET, "Expected ']' after index.");
-    emitByte_(OpCode::INDEX_GET);
+    if( canAssign && match_(Token::EQUAL) ){
+        // a[i] = v leaves v on the stack, like any other assignment:
+        expression_();
+        emitByte_(OpCode::INDEX_SET);
+    }else{
+        emitByte_(OpCode::INDEX_GET);
+    }
 }
 
 void Compiler::number_() {
     // shouldn't fail as we already validated the token as a number:
-    double n = strtod(previousToken_.string->getCString(), nullptr);
-    
-    // simplify operation for common values:
-    if( n == 0 ){
-        emitByte_(OpCode::PUSH_ZERO);
-    }else if( n == 1 ){
-        emitByte_(OpCode::PUSH_ONE);
-    }else{
-        emitLiteral_(Value::number(n));
-    }
+    double n = tokenNumber_(previousToken_);
+    emitConstant_(Value::number(n));
 }
 
 void Compiler::string_() {
-    emitLiteral_(Value::string(previousToken_.string));
+    emitConstant_(Value::string(tokenString_(previousToken_)));
 }
 
 void Compiler::variable_(bool canAssign) {
-    getSetVariable_(previousToken_.string, canAssign);
+    getSetVariable_(tokenString_(previousToken_), canAssign);
 }
 
 void Compiler::getSetVariable_(ObjString * name, bool canAssign) {
-    uint8_t getOp, setOp, arg; // opcodes for getting and setting the variable, and their argument
+    uint8_t getOp, setOp; // opcodes for getting and setting the variable
+    uint32_t arg;         // and their argument
+
+    ObjFunction * fn = nullptr;  // const functions, to inline calls to
 
     // first, try to look up
     bool isConst;
@@ -964,6 +1603,12 @@ void Compiler::getSetVariable_(ObjString * name, bool canAssign) {
         getOp = OpCode::GET_LOCAL;
         setOp = OpCode::SET_LOCAL;
         arg = (uint8_t)res;  // arg is the stack position of the local var
+        fn = currentEnv_->locals[res].function;
+
+        // a local function escapes if its value is used for anything but a call:
+        if( !check_(Token::LEFT_PAREN) ){
+            currentEnv_->locals[res].isEscaping = true;
+        }
 
     }else if((res = currentEnv_->resolveUpvalue(this, name, isConst)) != Local::NOT_FOUND) {
         // its an upvalue
@@ -977,6 +1622,13 @@ void Compiler::getSetVariable_(ObjString * name, bool canAssign) {
         getOp = OpCode::GET_GLOBAL;
         setOp = OpCode::SET_GLOBAL;
         arg = makeIdentifierLiteral_(name);  // arg is the literal index of the globals name
+        auto found = globalFunctions_.find(name);
+        if( found != globalFunctions_.end() ) fn = found->second;
+    }
+
+    // a call to a known function might be inlined, leaving the function itself unused:
+    if( fn != nullptr && check_(Token::LEFT_PAREN) && inlineCall_(name, fn, getOp, arg) ){
+        return;
     }
 
     // identify whether we are setting or getting a variable:
@@ -986,11 +1638,111 @@ void Compiler::getSetVariable_(ObjString * name, bool canAssign) {
         }
         // setting the variable:
         expression_();  // the value to set
-        emitBytes_(setOp, arg);
+        emitLiteralOp_(setOp, arg);
     }else{
         // getting the variable:
-        emitBytes_(getOp, arg);
+        emitLiteralOp_(getOp, arg);
+    }
+}
+
+bool Compiler::inlineCall_(ObjString * name, ObjFunction * fn, uint8_t getOp, uint32_t arg) {
+    if( !options_.optimise ) return false;
+
+    if( inlineBody_(fn, false) == nullptr ){
+        consume_(Token::LEFT_PAREN, "Expected '(' for call.");
+        uint8_t argCount = arguments_();
+        if( argCount == fn->numInputs ){
+            // The arguments stay on the stack, where the body finds them:
+            int start = getCurrentChunk_()->count();
+            inlineBody_(fn, true);
+            // so a runtime error in the body still shows the function in the stack trace:
+            getCurrentChunk_()->addInlinedCall(start, fn->chunk.getLineNumber(0), makeIdentifierLiteral_(name));
+            return true;
+        }
+
+        // The call would fail, so make it fail the same way at runtime:
+        for( int i = 0; i < argCount; i++ ) emitByte_(OpCode::POP);
+        emitLiteralOp_(getOp, arg);
+        for( int i = 0; i < argCount; i++ ) emitByte_(OpCode::NIL);
+        emitBytes_(OpCode::CALL, argCount);
+        return true;
+    }
+    return false;
+}
+
+char const * Compiler::inlineBody_(ObjFunction * fn, bool emit) {
+    if( fn->lazy != nullptr ) return "not compiled yet";
+    if( fn->numUpvalues > 0 ) return "captures variables";
+
+    // Only straight line expressions of the parameters and constants:
+    Chunk * chunk = &fn->chunk;
+    uint8_t * code = chunk->getCode();
+    int numInputs = fn->numInputs;
+    int depth = 0;  // number of values the body has pushed above the arguments
+    for( int offset = 0; offset < chunk->count(); ){
+        if( offset >= INLINE_MAX_BYTES ) return "too big";
+
+        uint8_t op = code[offset];
+        switch( op ){
+            case OpCode::GET_LOCAL:{
+                int slot = code[offset + 1];
+                if( slot < 1 || slot > numInputs ) return "has local variables";
+                int distance = depth + numInputs - slot;  // from the top of the stack
+                if( distance > UINT8_MAX ) return "too big";
+                if( emit ) emitBytes_(OpCode::PEEK, (uint8_t)distance);
+                depth++;
+                offset += 2;
+                break;
+            }
+            case OpCode::LITERAL:
+                if( emit ) emitLiteral_(chunk->getLiteral(code[offset + 1]));
+                depth++;
+                offset += 2;
+                break;
+            case OpCode::PUSH_ZERO:
+            case OpCode::PUSH_ONE:
+            case OpCode::NIL:
+            case OpCode::TRUE:
+            case OpCode::FALSE:
+            case OpCode::TYPE_BOOL:
+            case OpCode::TYPE_FLOAT:
+            case OpCode::TYPE_FUNCTION:
+            case OpCode::TYPE_STRING:
+            case OpCode::TYPE_TYPEID:
+                if( emit ) emitByte_(op);
+                depth++;
+                offset++;
+                break;
+            case OpCode::EQUAL:
+            case OpCode::NOT_EQUAL:
+            case OpCode::GREATER:
+            case OpCode::GREATER_EQUAL:
+            case OpCode::LESS:
+            case OpCode::LESS_EQUAL:
+            case OpCode::ADD:
+            case OpCode::SUBTRACT:
+            case OpCode::MULTIPLY:
+            case OpCode::DIVIDE:
+                if( emit ) emitByte_(op);
+                depth--;
+                offset++;
+                break;
+            case OpCode::NEGATE:
+            case OpCode::NOT:
+                if( emit ) emitByte_(op);
+                offset++;
+                break;
+            case OpCode::RETURN:
+                // anything under the result is a local variable, which would be left on the stack:
+                if( depth != 1 ) return "has local variables";
+                // leave the result in place of the arguments:
+                if( emit && numInputs > 0 ) emitBytes_(OpCode::POP_UNDER, (uint8_t)numInputs);
+                return nullptr;
+            default:
+                return "not a simple expression";
+        }
     }
+    return "not a simple expression";
 }
 
 Precedence Compiler::getInfixPrecedence_(Token::Type type) {
@@ -1049,6 +1801,7 @@ Precedence Compiler::getInfixPrecedence_(Token::Type type) {
         case Token::ECHO:
         case Token::RETURN:
         case Token::STRING_TYPE:
+        case Token::SWITCH:
         case Token::TRUE:
         case Token::TYPE:
         case Token::TYPEID:
@@ -1061,10 +1814,10 @@ Precedence Compiler::getInfixPrecedence_(Token::Type type) {
     }
 }
 
-bool Compiler::infixOperation_(Token::Type type) {
+bool Compiler::infixOperation_(Token::Type type, bool canAssign) {
     switch( type ){
         case Token::LEFT_PAREN:      call_();                           return true;
-        case Token::LEFT_BRACKET:    index_();                          return true;
+        case Token::LEFT_BRACKET:    index_(canAssign);                 return true;
 
         case Token::STAR:            binary_(OpCode::MULTIPLY);         return true;
         case Token::SLASH:           binary_(OpCode::DIVIDE);           return true;
@@ -1110,6 +1863,7 @@ bool Compiler::infixOperation_(Token::Type type) {
         case Token::ECHO:
         case Token::RETURN:
         case Token::STRING_TYPE:
+        case Token::SWITCH:
         case Token::TRUE:
         case Token::TYPE:
         case Token::TYPEID:
@@ -1160,6 +1914,7 @@ bool Compiler::prefixOperation_(Token::Type type, bool canAssign) {
         // TODO while-expressions and for-expressions
         case Token::WHILE:
         case Token::FOR:
+        case Token::SWITCH:
             return false;
 
         // Not handled here
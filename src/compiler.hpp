@@ -2,7 +2,12 @@
 
 #include "chunk.hpp"
 #include "scanner.hpp"
+#include "options.hpp"
 #include "inputstream/inputstream.hpp"
+#include "inputstream/stringinputstream.hpp"
+
+#include <unordered_map>
+#include <vector>
 
 class Mem;
 class Compiler;
@@ -27,7 +32,10 @@ struct Local {
     int16_t depth;
     bool isDefined;
     bool isConst;
-    bool isCaptured;  // whether it is referenced by another function
+    uint8_t numCaptures;  // number of functions which enclose it as an upvalue
+    int closureOffset;    // local functions: position of the CLOSURE making the value, otherwise -1
+    bool isEscaping;      // local functions: the value is used other than by calling it
+    ObjFunction * function;  // local functions: the function, which calls can inline
 
     // Used by Environment when searching for locals:
     static int const NOT_FOUND = -1;
@@ -37,6 +45,7 @@ struct Local {
  * An "upvalue" is a local which is captured by a function as it becomes a closure
  */
 struct Upvalue {
+    ObjString * name;
     uint8_t index;  // referenced local's position on the stack
     bool isConst;   // constant or variable
     bool isLocal;   // true: is a local variable, false: is another upvalue
@@ -63,6 +72,7 @@ struct Environment {
     uint16_t scopeDepth;
 
     Environment(Mem * mem, ObjString * name, Type t);
+    Environment(Mem * mem, ObjFunction * fn, Type t);  // to compile an existing function
 
     /**
      * track a local variables position in the stack
@@ -81,6 +91,8 @@ struct Environment {
     /**
      * lookup a local in surrounding environments
      * The local is by definition an "upvalue" for this environment
+     * An environment without an enclosing one (a lazily compiled function) 
+     * searches the upvalues it was given instead
      * @return positional index or NOT_FOUND
      */
     int resolveUpvalue(Compiler * c, ObjString * name, bool & isConst);
@@ -88,7 +100,7 @@ struct Environment {
     /**
      * Add an upvalue to the current environment's function
      */
-    int addUpvalue(Compiler * c, uint8_t index, bool isConst, bool isLocal);
+    int addUpvalue(Compiler * c, ObjString * name, uint8_t index, bool isConst, bool isLocal);
 
     /**
      * mark latest local as initialised
@@ -109,9 +121,40 @@ struct Environment {
     void endScope(Compiler * c);
 };
 
+/**
+ * Remembers the bytecode emitted for the latest expression, so that operations
+ * on constants can be evaluated at compile time instead of at runtime.
+ * Only describes the end of the chunk while nothing else has been emitted since.
+ */
+struct EmittedExpression {
+    Chunk * chunk = nullptr;
+    int start = 0;            // offset of the first byte of the expression
+    int end = -1;             // offset just past the expression
+    int numLiterals = 0;      // size of the chunk's literal table before the expression
+    bool isConstant = false;  // the expression is a single instruction pushing value
+    bool isNumber = false;    // the expression always evaluates to a number
+    Value value = Value::nil();
+};
+
+/**
+ * A name declared inside a lazily scanned function body, and the brace depth it is declared at
+ */
+struct ScannedName {
+    ObjString * name;
+    int depth;
+};
+
+/**
+ * One value of a switch statement's case, and where its body starts
+ */
+struct SwitchCase {
+    Value value;
+    int body;  // offset of the body in the chunk
+};
+
 class Compiler {
 public:
-    Compiler(Mem * mem);
+    Compiler(Mem * mem, Options const & options);
 
     ~Compiler();
 
@@ -121,6 +164,12 @@ public:
     */
     ObjFunction * compile(const char * name, InputStream * stream);
 
+    /**
+     * Compile the body of a function which was only scanned by a lazy compile
+     * @return false if there was an error, which leaves the function still to compile
+     */
+    bool compileLazy(ObjFunction * function);
+
     // Mark root objects to prevent from garbage collection
     void gcMarkRoots();
 
@@ -131,6 +180,8 @@ private:
     bool peekAndCheck_(Token::Type type);
     void consume_(Token::Type type, const char* fmt, ...);
     bool match_(Token::Type type);
+    ObjString * tokenString_(Token & token);  // identifiers and strings
+    double tokenNumber_(Token const & token);
     Chunk * getCurrentChunk_();
 
     // parsing code structures:
@@ -142,6 +193,13 @@ private:
     bool if_(bool canBeExpression);           // returns isExpression
     void whileStatement_();
     void forStatement_();
+    void switchStatement_();
+    bool caseValue_(Value & value);  // a literal value, false if there isn't one
+    // dispatch to the case bodies from the switch value in valueLocal (default: -1 if none):
+    bool emitJumpTable_(std::vector<SwitchCase> const & cases, int defaultBody);  // false if too sparse
+    void emitStringSwitch_(std::vector<SwitchCase> const & cases, int defaultBody);
+    void emitCaseTests_(std::vector<SwitchCase> const & cases, int defaultBody, uint8_t valueLocal);
+    void emitSwitchEntry_(int target, int end);  // a JUMP or LOOP to target, or end if target is -1
     void synchronise_();
     bool block_(bool canBeExpression);        // returns isExpression
     void expressionBlock_();
@@ -152,13 +210,14 @@ private:
     // all return true if the token was valid for the operation and the operation created
     Precedence getInfixPrecedence_(Token::Type type);
     bool prefixOperation_(Token::Type type, bool canAssign);
-    bool infixOperation_(Token::Type type);
+    bool infixOperation_(Token::Type type, bool canAssign);
     void call_();
+    uint8_t arguments_();  // (a, b, ...) of a call, returns the argument count
     void list_();
     void type_();
     void print_();
     void echo_();
-    void index_();
+    void index_(bool canAssign);
     void and_();
     void or_();
     void number_();
@@ -170,18 +229,27 @@ private:
     // parsing functions:
     void funcDeclaration_();
     void funcAnonymous_();
-    void function_(ObjString * name, Environment::Type type);
+    void stackClosure_(Environment & env, Local & local);  // if the local function can't escape
+    ObjFunction * function_(ObjString * name, Environment::Type type);
+    void functionBody_(Environment & env);      // parameters and block
+    void scanFunctionBody_(Environment & env);  // lazy: find the extent and upvalues only
 
     // parsing variables:
     void varDeclaration_(bool isConst);
-    uint8_t parseVariable_(const char * errorMsg, bool isConst, bool isLocal);
+    uint32_t parseVariable_(const char * errorMsg, bool isConst, bool isLocal);
     void declareLocal_(bool isConst);
-    void defineVariable_(uint8_t global, bool isConst, bool isLocal);
+    void addHiddenLocal_();  // for values the compiler keeps on the stack
+    void defineVariable_(uint32_t global, bool isConst, bool isLocal);
 
     // references to variables:
     void variable_(bool canAssign);
     void getSetVariable_(ObjString * name, bool canAssign);
 
+    // inlining calls to const functions:
+    // false if it must be a real call, otherwise emits the call (getOp, arg: to get the function)
+    bool inlineCall_(ObjString * name, ObjFunction * fn, uint8_t getOp, uint32_t arg);
+    char const * inlineBody_(ObjFunction * fn, bool emit);  // reason it can't be inlined, or nullptr
+
     // bytecode helpers:
     void emitByte_(uint8_t byte);
     void emitByteAtLine_(uint8_t byte, uint16_t line);
@@ -196,8 +264,16 @@ private:
     void emitStringType_();
     void emitTypeIdType_();
     void emitLiteral_(Value value);
-    uint8_t makeLiteral_(Value value);
-    uint8_t makeIdentifierLiteral_(ObjString * name);
+    void emitConstant_(Value value);  // cheapest instruction(s) to push a constant
+
+    // constant folding:
+    EmittedExpression latestExpression_();  // end is -1 if not at the end of the chunk
+    void setLatestExpression_(int start, int numLiterals, bool isConstant, bool isNumber, Value value);
+    void discardFrom_(EmittedExpression const & expr);  // remove expr and everything after it
+    bool foldBinary_(uint8_t opCode, Value a, Value b, Value & result);
+    void emitLiteralOp_(uint8_t op, uint32_t literal);  // op with a literal index operand
+    uint32_t makeLiteral_(Value value);
+    uint32_t makeIdentifierLiteral_(ObjString * name);
     int emitJump_(uint8_t instr);
     void setJumpDestination_(int offset);
     void emitLoop_(int loopStart);
@@ -205,6 +281,7 @@ private:
     // Environment:
     void initEnvironment_(Environment & env);
     ObjFunction * endEnvironment_();
+    void disassemble_(ObjFunction * fn);  // nested functions first
 
     // error production:
     void fatalError_(const char* fmt, ...);
@@ -214,7 +291,11 @@ private:
     void errorAtVargs_(Token* token, const char* message, va_list args);
 
     Mem * mem_;
+    Options options_;
     ObjString * name_;
+    ObjString * source_;  // lazy: text of the whole script
+    ObjString * path_;    // lazy: path of the script, or nullptr
+    StringInputStream * sourceStream_;  // lazy: stream over source_
     Scanner scanner_;
     Environment * currentEnv_;
     Token currentToken_;
@@ -222,6 +303,11 @@ private:
     bool hadError_;
     bool hadFatalError_;
     bool panicMode_;
+    EmittedExpression latest_;
+    std::unordered_map<ObjString *, ObjFunction *> globalFunctions_;  // const global functions, for inlining
+
+    static int const INLINE_MAX_BYTES = 32;  // largest function body to inline
+    static int const JUMP_TABLE_MAX_HOLES = 2;  // unused entries allowed per case in a jump table
 
     friend class Environment; // environment needs to call error functions!
 };
@@ -5,6 +5,7 @@
 #include <stdlib.h>
 
 #include "function.hpp"
+#include "outputstream/stdiooutputstream.hpp"
 
 
 Disassembler::Disassembler(){
@@ -17,6 +18,12 @@ void Disassembler::disassembleChunk(Chunk * chunk, char const * name){
     printf("== %s ==\n", name);
 
     for( int offset = 0; offset < chunk->count(); ) {
+        InlinedCall const * inlined = chunk->getInlinedCall(offset);
+        if( inlined != nullptr && inlined->start == offset ){
+            printf("%04d      | inlined ", offset);
+            chunk->literals[inlined->name].print(StdioOutputStream::getStdout(), false);
+            printf(" from line %d\n", inlined->line);
+        }
         int line = chunk->getLineNumber(offset);
         int incr = disassembleInstruction_(chunk, offset, line);
         offset += incr;
@@ -37,7 +44,10 @@ int Disassembler::disassembleInstruction_(Chunk * chunk, int offset, int line){
         case OpCode::PUSH_ZERO:     return simpleInstruction_("PUSH_ZERO");
         case OpCode::PUSH_ONE:      return simpleInstruction_("PUSH_ONE");
         case OpCode::LITERAL:       return literalInstruction_("LITERAL", chunk, offset);
+        case OpCode::LITERAL_LONG:  return literalInstruction_("LITERAL_LONG", chunk, offset, true);
         case OpCode::CLOSURE:       return closureInstruction_("CLOSURE", chunk, offset);
+        case OpCode::CLOSURE_LONG:  return closureInstruction_("CLOSURE_LONG", chunk, offset, true);
+        case OpCode::CLOSURE_STACK: return closureInstruction_("CLOSURE_STACK", chunk, offset);
         case OpCode::NIL:           return simpleInstruction_("NIL");
         case OpCode::TRUE:          return simpleInstruction_("TRUE");
         case OpCode::FALSE:         return simpleInstruction_("FALSE");
@@ -47,15 +57,23 @@ int Disassembler::disassembleInstruction_(Chunk * chunk, int offset, int line){
         case OpCode::TYPE_STRING:   return simpleInstruction_("TYPE_STRING");
         case OpCode::ADD:           return simpleInstruction_("ADD");
         case OpCode::POP:           return simpleInstruction_("POP");
+        case OpCode::PEEK:          return argInstruction_("PEEK", chunk, offset);
+        case OpCode::POP_UNDER:     return argInstruction_("POP_UNDER", chunk, offset);
         case OpCode::CLOSE_UPVALUE:       return simpleInstruction_("CLOSE_UPVALUE");
         case OpCode::DEFINE_GLOBAL_VAR:   return literalInstruction_("DEFINE_GLOBAL_VAR", chunk, offset);
+        case OpCode::DEFINE_GLOBAL_VAR_LONG:   return literalInstruction_("DEFINE_GLOBAL_VAR_LONG", chunk, offset, true);
         case OpCode::DEFINE_GLOBAL_CONST: return literalInstruction_("DEFINE_GLOBAL_CONST", chunk, offset);
-        case OpCode::GET_GLOBAL:    return byteInstruction_("GET_GLOBAL", chunk, offset);
-        case OpCode::SET_GLOBAL:    return byteInstruction_("SET_GLOBAL", chunk, offset);
+        case OpCode::DEFINE_GLOBAL_CONST_LONG: return literalInstruction_("DEFINE_GLOBAL_CONST_LONG", chunk, offset, true);
+        case OpCode::GET_GLOBAL:    return literalInstruction_("GET_GLOBAL", chunk, offset);
+        case OpCode::GET_GLOBAL_LONG:    return literalInstruction_("GET_GLOBAL_LONG", chunk, offset, true);
+        case OpCode::SET_GLOBAL:    return literalInstruction_("SET_GLOBAL", chunk, offset);
+        case OpCode::SET_GLOBAL_LONG:    return literalInstruction_("SET_GLOBAL_LONG", chunk, offset, true);
         case OpCode::GET_LOCAL:     return argInstruction_("GET_LOCAL", chunk, offset);
         case OpCode::SET_LOCAL:     return argInstruction_("SET_LOCAL", chunk, offset);
         case OpCode::GET_UPVALUE:   return argInstruction_("GET_UPVALUE", chunk, offset);
         case OpCode::SET_UPVALUE:   return argInstruction_("SET_UPVALUE", chunk, offset);
+        case OpCode::GET_ENCLOSING: return argInstruction_("GET_ENCLOSING", chunk, offset);
+        case OpCode::SET_ENCLOSING: return argInstruction_("SET_ENCLOSING", chunk, offset);
         case OpCode::EQUAL:         return simpleInstruction_("EQUAL");
         case OpCode::NOT_EQUAL:     return simpleInstruction_("NOT_EQUAL");
         case OpCode::GREATER:       return simpleInstruction_("GREATER");
@@ -67,8 +85,9 @@ int Disassembler::disassembleInstruction_(Chunk * chunk, int offset, int line){
         case OpCode::DIVIDE:        return simpleInstruction_("DIVIDE");
         case OpCode::NEGATE:        return simpleInstruction_("NEGATE");
         case OpCode::NOT:           return simpleInstruction_("NOT");
-        case OpCode::COMPARE_ITERATOR:   return simpleInstruction_("COMPARE_ITERATOR");
         case OpCode::MAKE_LIST:     return argInstruction_("MAKE_LIST", chunk, offset);
+        case OpCode::INDEX_GET:     return simpleInstruction_("INDEX_GET");
+        case OpCode::INDEX_SET:     return simpleInstruction_("INDEX_SET");
         case OpCode::PRINT:         return simpleInstruction_("PRINT");
         case OpCode::ECHO:          return simpleInstruction_("ECHO");
         case OpCode::TYPE:          return simpleInstruction_("TYPE");
@@ -78,29 +97,41 @@ int Disassembler::disassembleInstruction_(Chunk * chunk, int offset, int line){
         case OpCode::JUMP_IF_FALSE: return jumpInstruction_("JUMP_IF_FALSE", 1, chunk, offset);
         case OpCode::JUMP_IF_TRUE_POP: return jumpInstruction_("JUMP_IF_TRUE_POP", 1, chunk, offset);
         case OpCode::JUMP_IF_FALSE_POP: return jumpInstruction_("JUMP_IF_FALSE_POP", 1, chunk, offset);
-        case OpCode::JUMP_IF_ZERO:  return jumpInstruction_("JUMP_IF_ZERO", 1, chunk, offset);
+        case OpCode::FOR_PREP:      return forInstruction_("FOR_PREP", 1, chunk, offset);
+        case OpCode::FOR_PREP_INCLUSIVE: return forInstruction_("FOR_PREP_INCLUSIVE", 1, chunk, offset);
+        case OpCode::FOR_STEP:      return forInstruction_("FOR_STEP", -1, chunk, offset);
+        case OpCode::JUMP_TABLE:    return jumpTableInstruction_(chunk, offset);
+        case OpCode::SWITCH_STRING: return switchStringInstruction_(chunk, offset);
         case OpCode::CALL:          return byteInstruction_("CALL", chunk, offset);
         case OpCode::RETURN:        return simpleInstruction_("RETURN");
+        case OpCode::YIELD:         return simpleInstruction_("YIELD");
         default:
             printf("Unknown opcode %i\n", instr);
             return 1;
     }
 }
 
-int Disassembler::literalInstruction_(char const * name, Chunk * chunk, int offset){
-    uint8_t literalIdx = chunk->code[offset + 1];
-    printf("%-16s %4d ", name, literalIdx);
-    chunk->literals[literalIdx].print(true);
+// Literal index operand: 1 byte, or 3 bytes (big endian) for the _LONG instructions
+static uint32_t readLiteralIndex_(uint8_t const * operand, bool isLong) {
+    if( !isLong ) return operand[0];
+    return ((uint32_t)operand[0] << 16) | ((uint32_t)operand[1] << 8) | operand[2];
+}
+
+int Disassembler::literalInstruction_(char const * name, Chunk * chunk, int offset, bool isLong){
+    uint32_t literalIdx = readLiteralIndex_(&chunk->code[(size_t)offset + 1], isLong);
+    printf("%-16s %4u ", name, literalIdx);
+    chunk->literals[literalIdx].print(StdioOutputStream::getStdout(), true);
     printf("\n");
-    return 2;
+    return isLong ? 4 : 2;
 }
 
-int Disassembler::closureInstruction_(char const * name, Chunk * chunk, int offset){
+int Disassembler::closureInstruction_(char const * name, Chunk * chunk, int offset, bool isLong){
     int initialOffset = offset;
     offset ++;
-    uint8_t literalIdx = chunk->code[offset++];
-    printf("%-16s %4d ", name, literalIdx);
-    chunk->literals[literalIdx].print(true);
+    uint32_t literalIdx = readLiteralIndex_(&chunk->code[(size_t)offset], isLong);
+    offset += isLong ? 3 : 1;
+    printf("%-16s %4u ", name, literalIdx);
+    chunk->literals[literalIdx].print(StdioOutputStream::getStdout(), true);
     printf("\n");
 
     ObjFunction* fn = chunk->literals[literalIdx].asObjFunction();
@@ -138,6 +169,31 @@ int Disassembler::jumpInstruction_(const char* name, int sign, Chunk* chunk, int
     return 3;
 }
 
+// Slot operand, then jump distance from the end of the instruction
+int Disassembler::forInstruction_(const char* name, int sign, Chunk* chunk, int offset) {
+    uint8_t slot = chunk->code[offset + 1];
+    int jumpLen = (chunk->code[offset + 2] << 8) | chunk->code[offset + 3];
+    printf("%-16s %4d %4d -> %d\n", name, slot, offset,
+            offset + 4 + sign * jumpLen);
+    return 4;
+}
+
+// min, count: the JUMP or LOOP for each case follows
+int Disassembler::jumpTableInstruction_(Chunk* chunk, int offset) {
+    int16_t min = (int16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+    int count = (chunk->code[offset + 3] << 8) | chunk->code[offset + 4];
+    printf("%-16s %4d %4d\n", "JUMP_TABLE", min, count);
+    return 5;
+}
+
+// count, log2 of table size, table, then a literal index per case
+int Disassembler::switchStringInstruction_(Chunk* chunk, int offset) {
+    int count = (chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+    int bits = chunk->code[offset + 3];
+    printf("%-16s %4d %4d\n", "SWITCH_STRING", count, 1 << bits);
+    return 4 + (2 << bits) + 3 * count;
+}
+
 // void debugScanner(char const * source) {
 //     Scanner scanner;
 //     scanner.init(source);
@@ -185,21 +241,9 @@ char const * tokenTypeToStr(Token::Type t) {
         case Token::IDENTIFIER:     return "IDENTIFIER";
         case Token::STRING:         return "STRING";
         case Token::NUMBER:         return "NUMBER";
-        case Token::AND:            return "AND";
-        case Token::CONST:          return "CONST";
-        case Token::ELSE:           return "ELSE";
-        case Token::FALSE:          return "FALSE";
-        case Token::FOR:            return "FOR";
-        case Token::FN:             return "FN";
-        case Token::IF:             return "IF";
-        case Token::NIL:            return "NIL";
-        case Token::OR:             return "OR";
-        case Token::PRINT:          return "PRINT";
-        case Token::RETURN:         return "RETURN";
-        case Token::TRUE:           return "TRUE";
-        case Token::TYPE:           return "TYPE";
-        case Token::VAR:            return "VAR";
-        case Token::WHILE:          return "WHILE";
+#define KEYWORD_NAME_(type, text) case Token::type: return #type;
+        SCANNER_KEYWORDS(KEYWORD_NAME_)
+#undef KEYWORD_NAME_
         case Token::ERROR:          return "ERROR";
         case Token::END:            return "END";
         default:                    return "UNIDENTIFIED";
@@ -211,7 +255,7 @@ void debugObjectLinkedList(Obj * obj) {
     printf("Objects:\n");
     while( obj != nullptr ){
         printf("  %p: ", obj);
-        obj->print(true);
+        obj->print(StdioOutputStream::getStdout(), true);
         printf("\n");
         obj = obj->next;
     }
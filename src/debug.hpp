@@ -18,12 +18,15 @@ public:
 
 private:
     int disassembleInstruction_(Chunk * chunk, int offset, int line);
-    int literalInstruction_(char const * name, Chunk * chunk, int offset);
-    int closureInstruction_(char const * name, Chunk * chunk, int offset);
+    int literalInstruction_(char const * name, Chunk * chunk, int offset, bool isLong = false);
+    int closureInstruction_(char const * name, Chunk * chunk, int offset, bool isLong = false);
     int byteInstruction_(char const * name, Chunk * chunk, int offset);
     int argInstruction_(char const * name, Chunk * chunk, int offset);
     int simpleInstruction_(char const * name);
     int jumpInstruction_(const char* name, int sign, Chunk* chunk, int offset);
+    int forInstruction_(const char* name, int sign, Chunk* chunk, int offset);
+    int jumpTableInstruction_(Chunk* chunk, int offset);
+    int switchStringInstruction_(Chunk* chunk, int offset);
 };
 
 #ifdef DEBUG_GC
@@ -0,0 +1,266 @@
+#include "floatarray.hpp"
+#include "str.hpp"
+#include "number.hpp"
+#include "outputstream/outputstream.hpp"
+
+#include <math.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define FLOATARRAY_AVX2
+#endif
+
+// ----------------------------------------------------------------------------
+// Scalar kernels
+// ----------------------------------------------------------------------------
+static double sumScalar_(double const * a, int n) {
+    double s = 0;
+    for( int i = 0; i < n; i++ ) s += a[i];
+    return s;
+}
+
+// A NaN anywhere makes the min and max NaN, whichever kernel runs:
+static inline double min_(double a, double m) {
+    return a < m || a != a ? a : m;
+}
+
+static inline double max_(double a, double m) {
+    return a > m || a != a ? a : m;
+}
+
+static double minScalar_(double const * a, int n) {
+    double m = a[0];
+    for( int i = 1; i < n; i++ ) m = min_(a[i], m);
+    return m;
+}
+
+static double maxScalar_(double const * a, int n) {
+    double m = a[0];
+    for( int i = 1; i < n; i++ ) m = max_(a[i], m);
+    return m;
+}
+
+static double dotScalar_(double const * a, double const * b, int n) {
+    double s = 0;
+    for( int i = 0; i < n; i++ ) s += a[i] * b[i];
+    return s;
+}
+
+static void scaleScalar_(double * out, double const * a, double k, int n) {
+    for( int i = 0; i < n; i++ ) out[i] = a[i] * k;
+}
+
+static void addScalar_(double * out, double const * a, double const * b, int n) {
+    for( int i = 0; i < n; i++ ) out[i] = a[i] + b[i];
+}
+
+// ----------------------------------------------------------------------------
+// AVX2 kernels: 4 doubles at a time, scalar tail
+// NOTE: sums are accumulated in a different order to the scalar kernels
+// ----------------------------------------------------------------------------
+#ifdef FLOATARRAY_AVX2
+
+static bool hasAvx2_() {
+    static bool const hasAvx2 = __builtin_cpu_supports("avx2");
+    return hasAvx2;
+}
+
+__attribute__((target("avx2")))
+static double hsum_(__m256d v) {
+    __m128d lo = _mm256_castpd256_pd128(v);
+    __m128d hi = _mm256_extractf128_pd(v, 1);
+    lo = _mm_add_pd(lo, hi);
+    return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+}
+
+__attribute__((target("avx2")))
+static double sumAvx2_(double const * a, int n) {
+    // two accumulators to hide the latency of the adds
+    __m256d s0 = _mm256_setzero_pd();
+    __m256d s1 = _mm256_setzero_pd();
+    int i = 0;
+    for( ; i + 8 <= n; i += 8 ){
+        s0 = _mm256_add_pd(s0, _mm256_loadu_pd(a + i));
+        s1 = _mm256_add_pd(s1, _mm256_loadu_pd(a + i + 4));
+    }
+    if( i + 4 <= n ){
+        s0 = _mm256_add_pd(s0, _mm256_loadu_pd(a + i));
+        i += 4;
+    }
+    return hsum_(_mm256_add_pd(s0, s1)) + sumScalar_(a + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static double minAvx2_(double const * a, int n) {
+    if( n < 4 ) return minScalar_(a, n);
+    __m256d m = _mm256_loadu_pd(a);
+    // vmin/vmaxpd return their second operand if either is NaN, so NaNs are tracked on the side:
+    __m256d nan = _mm256_cmp_pd(m, m, _CMP_UNORD_Q);
+    int i = 4;
+    for( ; i + 4 <= n; i += 4 ){
+        __m256d v = _mm256_loadu_pd(a + i);
+        m = _mm256_min_pd(m, v);
+        nan = _mm256_or_pd(nan, _mm256_cmp_pd(v, v, _CMP_UNORD_Q));
+    }
+    if( _mm256_movemask_pd(nan) != 0 ) return NAN;
+    double lanes[4];
+    _mm256_storeu_pd(lanes, m);
+    double result = minScalar_(lanes, 4);
+    for( ; i < n; i++ ) result = min_(a[i], result);
+    return result;
+}
+
+__attribute__((target("avx2")))
+static double maxAvx2_(double const * a, int n) {
+    if( n < 4 ) return maxScalar_(a, n);
+    __m256d m = _mm256_loadu_pd(a);
+    // vmin/vmaxpd return their second operand if either is NaN, so NaNs are tracked on the side:
+    __m256d nan = _mm256_cmp_pd(m, m, _CMP_UNORD_Q);
+    int i = 4;
+    for( ; i + 4 <= n; i += 4 ){
+        __m256d v = _mm256_loadu_pd(a + i);
+        m = _mm256_max_pd(m, v);
+        nan = _mm256_or_pd(nan, _mm256_cmp_pd(v, v, _CMP_UNORD_Q));
+    }
+    if( _mm256_movemask_pd(nan) != 0 ) return NAN;
+    double lanes[4];
+    _mm256_storeu_pd(lanes, m);
+    double result = maxScalar_(lanes, 4);
+    for( ; i < n; i++ ) result = max_(a[i], result);
+    return result;
+}
+
+__attribute__((target("avx2")))
+static double dotAvx2_(double const * a, double const * b, int n) {
+    __m256d s0 = _mm256_setzero_pd();
+    __m256d s1 = _mm256_setzero_pd();
+    int i = 0;
+    for( ; i + 8 <= n; i += 8 ){
+        s0 = _mm256_add_pd(s0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+        s1 = _mm256_add_pd(s1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+    }
+    if( i + 4 <= n ){
+        s0 = _mm256_add_pd(s0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+        i += 4;
+    }
+    return hsum_(_mm256_add_pd(s0, s1)) + dotScalar_(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void scaleAvx2_(double * out, double const * a, double k, int n) {
+    __m256d kv = _mm256_set1_pd(k);
+    int i = 0;
+    for( ; i + 4 <= n; i += 4 ){
+        _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), kv));
+    }
+    scaleScalar_(out + i, a + i, k, n - i);
+}
+
+__attribute__((target("avx2")))
+static void addAvx2_(double * out, double const * a, double const * b, int n) {
+    int i = 0;
+    for( ; i + 4 <= n; i += 4 ){
+        _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+    addScalar_(out + i, a + i, b + i, n - i);
+}
+
+#endif
+
+// ----------------------------------------------------------------------------
+// ObjFloatArray
+// ----------------------------------------------------------------------------
+ObjFloatArray::ObjFloatArray(Mem * mem, int len) : Obj(mem), values_((size_t)len, 0.0) {
+}
+
+ObjFloatArray::~ObjFloatArray() {
+}
+
+ObjString * ObjFloatArray::toString() {
+    return ObjString::newString(mem_, "<floatarray>");
+}
+
+void ObjFloatArray::print(OutputStream * out, bool verbose) {
+    (void) verbose;
+    out->writeChar('[');
+    for( int i = 0; i < len(); ++i ){
+        if( i > 0 ) out->writeString(", ");
+        char buf[Number::MAX_CHARS];
+        out->write(buf, Number::format(values_[i], buf));
+    }
+    out->writeChar(']');
+}
+
+bool ObjFloatArray::get(int i, double & v) {
+    // python-style count from the back
+    if( i < 0 ) i = len() + i;
+
+    // check out of bounds:
+    if( i < 0 || i >= len() ) return false;
+
+    v = values_[i];
+    return true;
+}
+
+bool ObjFloatArray::set(int i, double v) {
+    // python-style count from the back
+    if( i < 0 ) i = len() + i;
+
+    // check out of bounds:
+    if( i < 0 ) return false;
+
+    // grow the array, filling with zeroes:
+    if( i >= len() ){
+        values_.resize(i + 1, 0.0);
+    }
+    values_[i] = v;
+    return true;
+}
+
+double ObjFloatArray::sum() {
+#ifdef FLOATARRAY_AVX2
+    if( hasAvx2_() ) return sumAvx2_(data(), len());
+#endif
+    return sumScalar_(data(), len());
+}
+
+double ObjFloatArray::min() {
+#ifdef FLOATARRAY_AVX2
+    if( hasAvx2_() ) return minAvx2_(data(), len());
+#endif
+    return minScalar_(data(), len());
+}
+
+double ObjFloatArray::max() {
+#ifdef FLOATARRAY_AVX2
+    if( hasAvx2_() ) return maxAvx2_(data(), len());
+#endif
+    return maxScalar_(data(), len());
+}
+
+double ObjFloatArray::dot(ObjFloatArray * b) {
+#ifdef FLOATARRAY_AVX2
+    if( hasAvx2_() ) return dotAvx2_(data(), b->data(), len());
+#endif
+    return dotScalar_(data(), b->data(), len());
+}
+
+void ObjFloatArray::scale(ObjFloatArray * a, double k) {
+#ifdef FLOATARRAY_AVX2
+    if( hasAvx2_() ){
+        scaleAvx2_(data(), a->data(), k, len());
+        return;
+    }
+#endif
+    scaleScalar_(data(), a->data(), k, len());
+}
+
+void ObjFloatArray::add(ObjFloatArray * a, ObjFloatArray * b) {
+#ifdef FLOATARRAY_AVX2
+    if( hasAvx2_() ){
+        addAvx2_(data(), a->data(), b->data(), len());
+        return;
+    }
+#endif
+    addScalar_(data(), a->data(), b->data(), len());
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "object.hpp"
+#include <vector>
+
+/**
+ * Contiguous array of numbers, stored unboxed
+ */
+class ObjFloatArray : public Obj {
+public:
+    ObjFloatArray(Mem * mem, int len);
+
+    ~ObjFloatArray();
+
+    // implment Obj interface
+    virtual ObjString * toString() override;
+    virtual void print(OutputStream * out, bool verbose) override;
+    virtual void gcMarkRefs() override {}
+
+    bool get(int i, double & v);
+    bool set(int i, double v);
+    int len() { return (int)values_.size(); }
+    double * data() { return values_.data(); }
+
+    // Kernels over whole arrays (vectorised where the cpu supports it):
+    double sum();
+    double min();   // array must not be empty; NaN if any value is
+    double max();   // array must not be empty; NaN if any value is
+    double dot(ObjFloatArray * b);             // arrays must be the same length
+    void scale(ObjFloatArray * a, double k);   // this = a * k
+    void add(ObjFloatArray * a, ObjFloatArray * b);  // this = a + b
+
+private:
+    std::vector<double> values_;
+};
@@ -1,38 +1,97 @@
 
 #include "function.hpp"
 #include "upvalue.hpp"
+#include "outputstream/outputstream.hpp"
+
+#include <new>
 
 ObjFunction::ObjFunction(Mem * mem, ObjString * funcName) : Obj(mem) {
     numInputs = 0;
     numUpvalues = 0;
     name = funcName;
+    lazy = nullptr;
+    closure = nullptr;
+    isGenerator = false;
 }
 
 ObjFunction::~ObjFunction() {
+    delete lazy;
 }
 
 ObjString * ObjFunction::toString() {
     return name;
 }
 
-void ObjFunction::print(bool verbose) {
+void ObjFunction::print(OutputStream * out, bool verbose) {
     if( verbose ){
-        printf("<fn:%s>", name->get());
+        out->writeString("<fn:");
+        name->print(out, false);
+        out->writeChar('>');
     }else{
-        puts(name->get());
+        name->print(out, false);
     }
 }
 
 void ObjFunction::gcMarkRefs() {
     name->gcMark();
     chunk.gcMarkRefs();
+    if( closure != nullptr ) closure->gcMark();
+    if( lazy != nullptr ){
+        lazy->script->gcMark();
+        if( lazy->path ) lazy->path->gcMark();
+        for( LazySource::Capture & capture : lazy->upvalues ){
+            capture.name->gcMark();
+        }
+    }
 }
 
 // -----------------------------------------------------
 
 
-ObjClosure::ObjClosure(Mem * mem, ObjFunction * func) : Obj(mem) {
+ObjNative::ObjNative(Mem * mem, ObjString * nativeName, int minIn, int maxIn, NativeFn nativeFn) : Obj(mem) {
+    fn = nativeFn;
+    minInputs = minIn;
+    maxInputs = maxIn;
+    name = nativeName;
+}
+
+ObjNative::~ObjNative() {
+}
+
+ObjString * ObjNative::toString() {
+    return name;
+}
+
+void ObjNative::print(OutputStream * out, bool verbose) {
+    if( verbose ){
+        out->writeString("<native:");
+        name->print(out, false);
+        out->writeChar('>');
+    }else{
+        name->print(out, false);
+    }
+}
+
+void ObjNative::gcMarkRefs() {
+    name->gcMark();
+}
+
+// -----------------------------------------------------
+
+
+ObjClosure * ObjClosure::newClosure(Mem * mem, ObjFunction * function, int numUpvalues) {
+    void * memory = ::operator new(sizeof(ObjClosure) + (size_t)numUpvalues * sizeof(ObjUpvalue *));
+    return new(memory) ObjClosure(mem, function, numUpvalues);
+}
+
+ObjClosure::ObjClosure(Mem * mem, ObjFunction * func, int n) : Obj(mem) {
     function = func;
+    enclosingSlots = nullptr;
+    numUpvalues = n;
+    // GC can run before they're all set:
+    for( int i = 0; i < n; i++ ){
+        upvalues()[i] = nullptr;
+    }
 }
 
 ObjClosure::~ObjClosure() {
@@ -42,17 +101,19 @@ ObjString * ObjClosure::toString() {
     return function->name;
 }
 
-void ObjClosure::print(bool verbose) {
+void ObjClosure::print(OutputStream * out, bool verbose) {
     if( verbose ){
-        printf("<cl:%s>", function->name->get());
+        out->writeString("<cl:");
+        function->name->print(out, false);
+        out->writeChar('>');
     }else{
-        puts(function->name->get());
+        function->name->print(out, false);
     }
 }
 
 void ObjClosure::gcMarkRefs() {
     function->gcMark();
-    for( ObjUpvalue * u : upvalues ){
-        u->gcMark();
+    for( int i = 0; i < numUpvalues; i++ ){
+        if( upvalues()[i] != nullptr ) upvalues()[i]->gcMark();
     }
 }
\ No newline at end of file
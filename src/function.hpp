@@ -5,6 +5,27 @@
 #include "str.hpp"
 #include <vector>
 
+// Predeclare Vm
+class Vm;
+class ObjClosure;
+
+
+/**
+ * Where to find the body of a function which hasn't been compiled yet (--lazy)
+ */
+struct LazySource {
+    struct Capture {
+        ObjString * name;
+        bool isConst;
+    };
+
+    ObjString * script;  // text of the whole script
+    ObjString * path;    // for error messages, or nullptr if not from a file
+    uint32_t offset;     // position in script just after the '(' starting the parameters
+    uint16_t line, col;  // of the '('
+    std::vector<Capture> upvalues;  // variables enclosed by the function, in upvalue order
+};
+
 
 /**
  * Functions are made at compile time
@@ -16,7 +37,7 @@ public:
 
     // implment Obj interface
     virtual ObjString * toString() override;
-    virtual void print(bool verbose) override;
+    virtual void print(OutputStream * out, bool verbose) override;
     virtual void gcMarkRefs() override;
 
 public:
@@ -24,24 +45,64 @@ public:
     int numUpvalues;
     Chunk chunk;
     ObjString * name;  // function name
+    LazySource * lazy; // body still to compile on first call, or nullptr
+    ObjClosure * closure;  // if it captures nothing: the one closure shared by every evaluation
+    bool isGenerator;  // contains `yield`, so calls make an ObjGenerator rather than running the body
+};
+
+
+/**
+ * Built-in functions written in C++, called without a CallFrame:
+ * they read their arguments straight off the VM's stack and set a result in place of the call.
+ * @return false after reporting an error with Vm::nativeError
+ */
+typedef bool (*NativeFn)(Vm * vm, int argCount, Value * args, Value * result);
+
+class ObjNative : public Obj {
+public:
+    ObjNative(Mem * mem, ObjString * name, int minInputs, int maxInputs, NativeFn fn);
+    ~ObjNative();
+
+    // implment Obj interface
+    virtual ObjString * toString() override;
+    virtual void print(OutputStream * out, bool verbose) override;
+    virtual void gcMarkRefs() override;
+
+public:
+    NativeFn fn;
+    int minInputs, maxInputs;  // range of accepted argument counts
+    ObjString * name;
 };
 
 
 /**
  * Closures are made at runtime and wrap functions 
- * as well as enclosing Values, creating Upvalues
+ * as well as enclosing Values, creating Upvalues.
+ * The upvalues are stored in the same allocation, just after the object.
  */
 class ObjClosure : public Obj {
 public:
-    ObjClosure(Mem * mem, ObjFunction * function);
+    // Constructor helper: makes room for numUpvalues upvalues, all nullptr until set
+    static ObjClosure * newClosure(Mem * mem, ObjFunction * function, int numUpvalues);
+
     ~ObjClosure();
 
+    // Objects are deleted through Obj *, so the extra room must be freed along with them
+    static void operator delete(void * p) { ::operator delete(p); }
+
     // implment Obj interface
     virtual ObjString * toString() override;
-    virtual void print(bool verbose) override;
+    virtual void print(OutputStream * out, bool verbose) override;
     virtual void gcMarkRefs() override;
 
+    inline ObjUpvalue ** upvalues() { return (ObjUpvalue **)(this + 1); }
+
 public:
     ObjFunction * function;
-    std::vector<ObjUpvalue *> upvalues;
+    Value * enclosingSlots;  // CLOSURE_STACK: slots of the frame which made it, in place of upvalues
+    int numUpvalues;
+
+private:
+    // Private constructor: must construct with helper!
+    ObjClosure(Mem * mem, ObjFunction * function, int numUpvalues);
 };
@@ -0,0 +1,75 @@
+#include "generator.hpp"
+#include "function.hpp"
+#include "upvalue.hpp"
+#include "mem.hpp"
+#include "str.hpp"
+#include "outputstream/outputstream.hpp"
+
+
+ObjGenerator::ObjGenerator(Mem * mem, ObjClosure * genClosure, Value * slots, int numSlots) : Obj(mem) {
+    state = SUSPENDED;
+    closure = genClosure;
+    ip = closure->function->chunk.getCode();
+    target = nullptr;
+    doneIp = nullptr;
+    slots_.assign(slots, slots + numSlots);
+}
+
+ObjGenerator::~ObjGenerator() {
+}
+
+ObjString * ObjGenerator::toString() {
+    return closure->function->name;
+}
+
+void ObjGenerator::print(OutputStream * out, bool verbose) {
+    if( verbose ){
+        out->writeString("<generator:");
+        closure->function->name->print(out, false);
+        out->writeChar('>');
+    }else{
+        closure->function->name->print(out, false);
+    }
+}
+
+void ObjGenerator::gcMarkRefs() {
+    closure->gcMark();
+    for( Value & v : slots_ ) v.gcMark();
+    for( Capture & capture : captures_ ) capture.upvalue->gcMark();
+}
+
+Value * ObjGenerator::resume(Value * slots) {
+    state = RUNNING;
+    Value * stackTop = slots;
+    for( Value & v : slots_ ) *stackTop++ = v;
+    // keeps its capacity for the next suspend:
+    slots_.clear();
+
+    // Values set through the upvalues meanwhile were set in the upvalues themselves:
+    for( Capture & capture : captures_ ){
+        capture.upvalue->reopen(slots + capture.slot);
+    }
+    captures_.clear();
+    return stackTop;
+}
+
+void ObjGenerator::suspend(Value * slots, Value * stackTop, uint8_t * resumeIp) {
+    state = SUSPENDED;
+    ip = resumeIp;
+    slots_.assign(slots, stackTop);
+
+    if( mem_->hasOpenUpvalues(slots) ){
+        for( Value * slot = slots; slot < stackTop; slot++ ){
+            ObjUpvalue * upvalue = mem_->getOpenUpvalue(slot);
+            if( upvalue != nullptr ) captures_.push_back({(int)(slot - slots), upvalue});
+        }
+        mem_->closeUpvalues(slots);
+    }
+}
+
+void ObjGenerator::finish() {
+    state = DONE;
+    slots_.clear();
+    slots_.shrink_to_fit();
+    captures_.clear();
+}
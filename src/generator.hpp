@@ -0,0 +1,65 @@
+#pragma once
+
+#include "value.hpp"
+#include "object.hpp"
+
+#include <stdint.h>
+#include <vector>
+
+class ObjClosure;
+class ObjUpvalue;
+
+/**
+ * A call to a function containing `yield`, made by calling the function.
+ *
+ * The body runs a step at a time: resuming it pushes a frame as a call would,
+ * and `yield` (or the end of the body) pops that frame again.
+ * While suspended, the generator keeps its frame's stack segment itself, and any upvalues
+ * capturing its locals are closed, to be reopened on the stack when it resumes.
+ * So suspending and resuming cost the size of the frame, however deep the call which resumes it.
+ */
+class ObjGenerator : public Obj {
+public:
+    // Copies the closure and its arguments, slots[0] to slots[numSlots - 1], as the frame to start with
+    ObjGenerator(Mem * mem, ObjClosure * closure, Value * slots, int numSlots);
+    ~ObjGenerator();
+
+    // implment Obj interface
+    virtual ObjString * toString() override;
+    virtual void print(OutputStream * out, bool verbose) override;
+    virtual void gcMarkRefs() override;
+
+    /**
+     * Put the frame back on the stack from slots onwards, to carry on from ip
+     * @return the new stack top
+     */
+    Value * resume(Value * slots);
+
+    // Keep the frame from slots to stackTop, to carry on from ip when next resumed
+    void suspend(Value * slots, Value * stackTop, uint8_t * resumeIp);
+
+    // The body has returned, or a runtime error unwound it
+    void finish();
+
+    enum State {
+        SUSPENDED,  // including not started yet
+        RUNNING,
+        DONE
+    } state;
+
+    ObjClosure * closure;
+    uint8_t * ip;  // where to carry on from when resumed
+
+    // While running:
+    Value * target;   // the resumer's slot for the values it yields, and nil once it is done
+    uint8_t * doneIp; // where the resumer carries on from once it is done
+
+private:
+    struct Capture {
+        int slot;
+        ObjUpvalue * upvalue;
+    };
+
+    std::vector<Value> slots_;        // the frame, while suspended
+    std::vector<Capture> captures_;   // upvalues of the frame's slots, closed while suspended
+};
@@ -1,12 +1,14 @@
-
 #include "fileinputstream.hpp"
 
-#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 
 FileInputStream::FileInputStream() {
-  file_ = nullptr;
-  current_ = ' ';
+  path_ = nullptr;
+  index_ = 0;
 }
 
 FileInputStream::~FileInputStream() {
@@ -14,55 +16,102 @@ FileInputStream::~FileInputStream() {
 }
 
 bool FileInputStream::open(char const * path) {
-  file_ = fopen(path, "rb");
+  close();
   path_ = path;
-  if( file_ == nullptr ){
+  int fd = ::open(path, O_RDONLY);
+  if( fd < 0 ){
     return false;
   }
-  // prime the pump:
-  next_();
+
+  auto contents = std::make_shared<Contents>();
+  bool ok = map_(fd, *contents) || read_(fd, *contents);
+  ::close(fd);
+  if( !ok ){
+    return false;
+  }
+  contents_ = contents;
   return true;
 }
 
-void FileInputStream::close() {
-  if( file_ != nullptr ){
-    fclose(file_);
-    file_ = nullptr;
+bool FileInputStream::map_(int fd, Contents & contents) {
+  struct stat st;
+  if( fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 ){
+    return false;
   }
+  size_t size = (size_t)st.st_size;
+  void * mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if( mapped == MAP_FAILED ){
+    return false;
+  }
+  // read from start to end:
+  madvise(mapped, size, MADV_SEQUENTIAL);
+  contents.data = (char const *)mapped;
+  contents.size = size;
+  contents.isMapped = true;
+  return true;
+}
+
+bool FileInputStream::read_(int fd, Contents & contents) {
+  size_t const CHUNK_SIZE = 65536;
+  size_t size = 0;
+  for( ;; ){
+    contents.buffer.resize(size + CHUNK_SIZE);
+    ssize_t n = ::read(fd, contents.buffer.data() + size, CHUNK_SIZE);
+    if( n < 0 ){
+      return false;
+    }
+    if( n == 0 ) break;
+    size += (size_t)n;
+  }
+  contents.buffer.resize(size);
+  contents.data = contents.buffer.data();
+  contents.size = size;
+  return true;
+}
+
+FileInputStream::Contents::~Contents() {
+  if( isMapped ){
+    munmap((void *)data, size);
+  }
+}
+
+void FileInputStream::close() {
+  contents_.reset();
+  index_ = 0;
 }
 
 char FileInputStream::peek() {
-  return current_;
+  if( !contents_ || index_ >= contents_->size ){
+    return '\0';
+  }
+  return contents_->data[index_];
 }
 
 char FileInputStream::next() {
-  char c = current_;
+  char c = peek();
   if( c != '\0' ){
-    next_();
+    index_++;
   }
   return c;
 }
 
-bool FileInputStream::next_() {
-  long int i = ftell(file_);
-  // pop one character
-  int c = fgetc(file_);
-  if( c == EOF ){  // Error or End of file
-    close();
-    file_ = nullptr;
-    current_ = '\0';
-  }else{
-    current_ = (char)c;
-  }
-  return current_;
-}
-
 char const * FileInputStream::getPath() {
   return path_;
 }
 
 InputStream * FileInputStream::newCopy() {
-    auto f = new FileInputStream();
-    f->open(path_);
-    return f;
+  // shares the contents, rather than opening the file again:
+  auto f = new FileInputStream();
+  f->path_ = path_;
+  f->contents_ = contents_;
+  return f;
+}
+
+char const * FileInputStream::getBuffer(size_t & length) {
+  if( !contents_ ){
+    length = 0;
+    return nullptr;
+  }
+  length = contents_->size;
+  return contents_->data;
 }
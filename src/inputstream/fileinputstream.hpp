@@ -2,10 +2,15 @@
 
 #include "inputstream.hpp"
 
-#include <stdlib.h>
-#include <stdio.h>
+#include <stddef.h>
+#include <memory>
+#include <vector>
 
 
+/**
+ * Reads a whole file into memory when opened: regular files are mapped, anything else
+ * (pipes, terminals) is read into a buffer. Copies of the stream share the contents.
+ */
 class FileInputStream : public InputStream {
 public:
   FileInputStream();
@@ -14,7 +19,7 @@ public:
 
   bool open(char const * path);
 
-  void close();
+  virtual void close() override;
 
   virtual char peek() override;
 
@@ -24,12 +29,23 @@ public:
 
   virtual InputStream * newCopy() override;
 
+  virtual char const * getBuffer(size_t & length) override;
+
 private:
-  bool next_();
+  // The file's contents, released when the last stream using them is destroyed
+  struct Contents {
+    ~Contents();
+
+    char const * data = nullptr;
+    size_t size = 0;
+    bool isMapped = false;     // data is a mapping of the file, otherwise it points into buffer
+    std::vector<char> buffer;
+  };
 
-  static uint16_t const BUF_SIZE = 256;
+  static bool map_(int fd, Contents & contents);
+  static bool read_(int fd, Contents & contents);
 
-  FILE * file_;
+  std::shared_ptr<Contents> contents_;
   char const * path_;
-  char current_;
+  size_t index_;  // of the next character
 };
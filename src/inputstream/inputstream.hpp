@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 
 
 class InputStream {
@@ -33,4 +34,10 @@ public:
    * close the stream
    */
   virtual void close() = 0;
+
+  /**
+   * the whole input as contiguous memory, not null terminated,
+   * or nullptr if the stream can't provide it
+   */
+  virtual char const * getBuffer(size_t & length) { length = 0; return nullptr; }
 };
@@ -5,8 +5,9 @@
 #include <algorithm>
 
 
-StringInputStream::StringInputStream(char const * line) {
+StringInputStream::StringInputStream(char const * line, char const * path) {
   line_ = line;
+  path_ = path;
   index_ = 0;
   len_ = (int)strlen(line);
 }
@@ -29,12 +30,17 @@ char StringInputStream::next() {
 }
 
 char const * StringInputStream::getPath() {
-  return nullptr;
+  return path_;
 }
 
 InputStream * StringInputStream::newCopy() {
-    return new StringInputStream(line_);
+    return new StringInputStream(line_, path_);
 }
 
 void StringInputStream::close() {
 }
+
+char const * StringInputStream::getBuffer(size_t & length) {
+  length = (size_t)len_;
+  return line_;
+}
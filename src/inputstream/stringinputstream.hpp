@@ -6,7 +6,8 @@
 
 class StringInputStream : public InputStream {
 public:
-  StringInputStream(char const * line);
+  // path: reported for error messages
+  StringInputStream(char const * line, char const * path = nullptr);
 
   virtual ~StringInputStream();
 
@@ -20,8 +21,11 @@ public:
 
   virtual void close() override;
 
+  virtual char const * getBuffer(size_t & length) override;
+
 private:
   char const * line_;
+  char const * path_;
   int index_;
   int len_;
 };
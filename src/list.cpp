@@ -1,9 +1,11 @@
 
 #include "list.hpp"
 #include "str.hpp"
-#include <string.h>
+#include "outputstream/outputstream.hpp"
 
 ObjList::ObjList(Mem * mem) : Obj(mem) {
+    values_ = std::make_shared<std::vector<Value>>();
+    len_ = 0;
 }
 
 ObjList::~ObjList() {
@@ -13,34 +15,48 @@ ObjString * ObjList::toString() {
     return ObjString::newString(mem_, "<list>");
 }
 
-void ObjList::print(bool verbose) {
+void ObjList::print(OutputStream * out, bool verbose) {
     (void) verbose;
     if( len() == 0 ){
-        printf("[]");
+        out->writeString("[]");
         return;
     }
 
-    printf("[");
+    out->writeChar('[');
     for( int i = 0; i < len()-1; ++i ){
-        values_[i].print(true);
-        printf(", ");
+        (*values_)[i].print(out, true);
+        out->writeString(", ");
     }
-    values_[len()-1].print(true);
-    printf("]");
+    (*values_)[len()-1].print(out, true);
+    out->writeChar(']');
 }
 
 void ObjList::gcMarkRefs() {
-    for( Value & value : values_ ){
-        value.gcMark();
+    // only mark the values this list can see:
+    for( int i = 0; i < len_; ++i ){
+        (*values_)[i].gcMark();
     }
 }
 
+void ObjList::share(ObjList * a) {
+    values_ = a->values_;
+    len_ = a->len_;
+}
+
 void ObjList::concat(ObjList * a) {
-    values_.insert(values_.end(), a->values_.begin(), a->values_.end());
+    makeExtendable_();
+    if( a->values_ == values_ ){
+        // appending to our own storage would invalidate the source
+        makeUnique_();
+    }
+    values_->insert(values_->end(), a->values_->begin(), a->values_->begin() + a->len_);
+    len_ += a->len_;
 }
 
 void ObjList::append(Value v) {
-    values_.push_back(v);
+    makeExtendable_();
+    values_->push_back(v);
+    len_++;
 }
 
 bool ObjList::get(int i, Value & v) {
@@ -50,7 +66,7 @@ bool ObjList::get(int i, Value & v) {
     // check out of bounds:
     if( i < 0 || i >= len() ) return false;
 
-    v = values_[i];
+    v = (*values_)[i];
     return true;
 }
 
@@ -61,21 +77,40 @@ bool ObjList::set(int i, Value v) {
     // check out of bounds:
     if( i < 0 ) return false;
 
+    makeUnique_();
+
     // check if need to grow the list:
     if( i >= len() ){
-        int newLen = i + 1;
-        int firstNewIdx = len();
-        int numValues = newLen - len();
-
-        values_.resize(newLen);
-
-        // filling with zeroes is equivalent to filling with Nil values
-        memset(&values_[firstNewIdx], 0, numValues*sizeof(Value));
+        makeExtendable_();
+        // Value() is nil
+        values_->resize(i + 1, Value());
+        len_ = i + 1;
     }
-    values_[i] = v;
+    (*values_)[i] = v;
     return true;
 }
 
 int ObjList::len() {
-    return (int)values_.size();
+    return len_;
+}
+
+void ObjList::makeUnique_() {
+    if( values_.use_count() > 1 ){
+        values_ = std::make_shared<std::vector<Value>>(
+            values_->begin(), values_->begin() + len_);
+    }
+}
+
+void ObjList::makeExtendable_() {
+    // the storage extends past the end of this list:
+    if( len_ != (int)values_->size() ){
+        if( values_.use_count() > 1 ){
+            // another list is using the extra values
+            values_ = std::make_shared<std::vector<Value>>(
+                values_->begin(), values_->begin() + len_);
+        }else{
+            // left over from a list which no longer exists
+            values_->resize(len_);
+        }
+    }
 }
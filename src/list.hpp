@@ -3,7 +3,17 @@
 #include "value.hpp"
 #include "object.hpp"
 #include <vector>
+#include <memory>
 
+/**
+ * Lists share their storage copy-on-write.
+ *
+ * A list sees the first len_ values of its storage. Storage can be shared
+ * by several lists, e.g. `b = a + [x]` makes b share a's storage and
+ * extends it with x: a still sees only its own values.
+ * Only the list which sees the whole storage may extend it in place,
+ * and values are only modified in place if nothing else shares them.
+ */
 class ObjList : public Obj {
 public:
     ObjList(Mem * mem);
@@ -12,9 +22,12 @@ public:
 
     // implment Obj interface
     virtual ObjString * toString() override;
-    virtual void print(bool verbose) override;
+    virtual void print(OutputStream * out, bool verbose) override;
     virtual void gcMarkRefs() override;
 
+    // Become a copy of list a, sharing its storage
+    void share(ObjList * a);
+
     void concat(ObjList * a);
     void append(Value v);
     bool get(int i, Value & v);
@@ -22,6 +35,12 @@ public:
     int len();
 
 private:
-    std::vector<Value> values_;
-};
+    // Ensure this list has its own copy of the storage to modify
+    void makeUnique_();
 
+    // Ensure values can be appended without affecting other lists
+    void makeExtendable_();
+
+    std::shared_ptr<std::vector<Value>> values_;
+    int len_;
+};
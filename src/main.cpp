@@ -13,9 +13,9 @@
 #include <readline/history.h>
 
 
-static void repl() {
+static void repl(Options const & options) {
     Vm vm;
-    vm.init();
+    vm.init(options);
 
     // Use for debugging:
     const char * line = "var a = \"abc\";";
@@ -40,7 +40,7 @@ static void repl() {
     }
 }
 
-static void runFile(const char* path) {
+static void runFile(const char* path, Options const & options) {
     FileInputStream stream;
     if( !stream.open(path) ){
         fprintf(stderr, "Could not open file '%s'\n", path);
@@ -48,21 +48,41 @@ static void runFile(const char* path) {
     }
 
     Vm vm;
-    vm.init();
-    InterpretResult result = vm.interpret(path, &stream);
+    vm.init(options);
+    InterpretResult result = vm.interpretFile(path, &stream);
 
     if (result == InterpretResult::COMPILE_ERR) exit(65);
     if (result == InterpretResult::RUNTIME_ERR) exit(70);
 }
 
+static int usage() {
+    fprintf(stderr, "Usage: sigil [--dis] [--no-opt] [--no-cache] [--lazy] [path]\n");
+    return 64;
+}
+
 int main(int argc, char const * argv[]) {
-    if( argc == 1 ){
-        repl();
-    }else if( argc == 2 ){
-        runFile(argv[1]);
+    Options options;
+    char const * path = nullptr;
+    for( int i = 1; i < argc; ++i ){
+        if( strcmp(argv[i], "--dis") == 0 ){
+            options.disassemble = true;
+        }else if( strcmp(argv[i], "--no-opt") == 0 ){
+            options.optimise = false;
+        }else if( strcmp(argv[i], "--no-cache") == 0 ){
+            options.useCache = false;
+        }else if( strcmp(argv[i], "--lazy") == 0 ){
+            options.lazy = true;
+        }else if( argv[i][0] == '-' || path != nullptr ){
+            return usage();
+        }else{
+            path = argv[i];
+        }
+    }
+
+    if( path == nullptr ){
+        repl(options);
     }else{
-        fprintf(stderr, "Usage: sigil [path]\n");
-        return 64;
+        runFile(path, options);
     }
 
     return 0;
@@ -2,11 +2,13 @@
 #include "mem.hpp"
 #include "vm.hpp"
 #include "debug.hpp"
+#include "outputstream/stdiooutputstream.hpp"
 
 Mem::Mem() {
     vm_ = nullptr;
     objects_ = nullptr;
-    openUpvalues_ = nullptr;
+    stack_ = nullptr;
+    highestOpen_ = nullptr;
     EMPTY_STRING = nullptr;
     init_ = false;
 }
@@ -34,12 +36,14 @@ void Mem::collectGarbage() {
     vm_->gcMarkRoots();
 
     // Mark open upvalues:
-    for( ObjUpvalue * u = openUpvalues_;
-            u != nullptr; 
-            u = u->getNextUpvalue() ){
+    for( Value * slot = stack_; slot <= highestOpen_; slot++ ){
+        ObjUpvalue * u = getOpenUpvalue(slot);
+        if( u == nullptr ) continue;
+#ifdef DEBUG_GC
         printf( "Mark upvalue:" );
-        u->print(true);
+        u->print(StdioOutputStream::getStdout(), true);
         printf("\n");
+#endif
         u->gcMark();
     }
 
@@ -82,7 +86,7 @@ void Mem::collectGarbage() {
 
 #ifdef DEBUG_GC
             printf(" %p: ", obj);
-            obj->print(true);
+            obj->print(StdioOutputStream::getStdout(), true);
             printf("\n");
 #endif
             if( obj->isMarked ){
@@ -103,7 +107,7 @@ void Mem::collectGarbage() {
 
 #ifdef DEBUG_GC
                 printf("Delete %p: ", unused);
-                unused->print(true);
+                unused->print(StdioOutputStream::getStdout(), true);
                 printf("\n");
 #endif
 
@@ -121,7 +125,7 @@ void Mem::collectGarbage() {
         while( obj != nullptr ){
 
             printf(" %p: ", obj);
-            obj->print(true);
+            obj->print(StdioOutputStream::getStdout(), true);
             printf("\n");
             obj = obj->next;
         }
@@ -148,16 +152,40 @@ void Mem::deregisterObj(Obj * obj){
     // TODO
 }
 
-void Mem::closeUpvalues(Value * stackTop){
+void Mem::initStack(Value * stack, int size) {
+    stack_ = stack;
+    openUpvalues_.assign((size_t)size, nullptr);
+    highestOpen_ = stack - 1;
+}
+
+void Mem::setOpenUpvalue(Value * slot, ObjUpvalue * upvalue) {
+    openUpvalues_[(size_t)(slot - stack_)] = upvalue;
+    if( slot > highestOpen_ ) highestOpen_ = slot;
+}
+
+void Mem::closeUpvalues_(Value * stackTop){
     // This function is called when the stack shrinks, and upvalues pointing to values
     // that just got popped of the stack should be closed.
 
-    // Note: the newest upvalue is at the head of the list
-    // Starting from the head, close upvalues that are off the end of the stackTop
-    while( openUpvalues_ != nullptr && openUpvalues_->ref() >= stackTop ){
-        // close the first upvalue, and shift the head along
-        openUpvalues_->close();
-        openUpvalues_ = openUpvalues_->getNextUpvalue();
+    // Only the slots being popped are visited, so closing costs no more than the pop
+    for( Value * slot = highestOpen_; slot >= stackTop; slot-- ){
+        ObjUpvalue * & upvalue = openUpvalues_[(size_t)(slot - stack_)];
+        if( upvalue != nullptr ){
+            upvalue->close();
+            upvalue = nullptr;
+        }
+    }
+    highestOpen_ = stackTop - 1;
+}
+
+void Mem::printOpenUpvalues() {
+    bool isFirst = true;
+    for( Value * slot = stack_; slot <= highestOpen_; slot++ ){
+        ObjUpvalue * upvalue = getOpenUpvalue(slot);
+        if( upvalue == nullptr ) continue;
+        if( !isFirst ) printf(" | ");
+        upvalue->print(StdioOutputStream::getStdout(), true);
+        isFirst = false;
     }
 }
 
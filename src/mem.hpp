@@ -30,14 +30,24 @@ public:
     void registerObj(Obj * obj);
     void deregisterObj(Obj * obj);
 
-    // get open upvalues list
-    ObjUpvalue * getRootOpenUpvalue(){ return openUpvalues_; }
-    
-    // Set the root of the open upvalue list
-    void setRootOpenUpvalue(ObjUpvalue * upvalue){ openUpvalues_ = upvalue; }
+    // Open upvalues are kept in an array parallel to the vm's stack, one for each captured slot
+    void initStack(Value * stack, int size);
+
+    // The open upvalue of a stack slot, or nullptr
+    inline ObjUpvalue * getOpenUpvalue(Value * slot){ return openUpvalues_[(size_t)(slot - stack_)]; }
+    void setOpenUpvalue(Value * slot, ObjUpvalue * upvalue);
+
+    // Whether any upvalues are open at or above slot
+    inline bool hasOpenUpvalues(Value * slot){ return slot <= highestOpen_; }
 
     // Close all upvalues left on the end of the stack when the stack top moves to stackTop
-    void closeUpvalues(Value * stackTop);
+    inline void closeUpvalues(Value * stackTop){
+        // most returns capture nothing, so skip them quickly:
+        if( stackTop <= highestOpen_ ) closeUpvalues_(stackTop);
+    }
+
+    // Print the open upvalues, lowest slot first
+    void printOpenUpvalues();
 
     // intern string helper
     StringSet * getInternedStrings(){ return &internedStrings_; }
@@ -46,11 +56,14 @@ public:
     ObjString * EMPTY_STRING;
 private:
     void freeObjects_();
+    void closeUpvalues_(Value * stackTop);
 
     bool init_;
     Vm * vm_;
     Obj * objects_;     // linked list of objects
-    ObjUpvalue * openUpvalues_;  // linked list of open upvalues
+    Value * stack_;
+    std::vector<ObjUpvalue *> openUpvalues_;  // for each stack slot, its open upvalue or nullptr
+    Value * highestOpen_;  // no upvalues are open above this slot
     StringSet internedStrings_;
     std::vector<Obj*> markedObjects_;  // gc marked objects
 };
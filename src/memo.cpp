@@ -0,0 +1,136 @@
+#include "memo.hpp"
+#include "function.hpp"
+#include "str.hpp"
+#include "outputstream/outputstream.hpp"
+
+#include <string.h>
+
+
+ObjMemo::ObjMemo(Mem * mem, ObjClosure * memoClosure, int cap) : Obj(mem) {
+    closure = memoClosure;
+    capacity = cap;
+    hits = 0;
+    misses = 0;
+    isKeyCacheable_ = false;
+}
+
+ObjMemo::~ObjMemo() {
+}
+
+ObjString * ObjMemo::toString() {
+    return closure->function->name;
+}
+
+void ObjMemo::print(OutputStream * out, bool verbose) {
+    if( verbose ){
+        out->writeString("<memo:");
+        closure->function->name->print(out, false);
+        out->writeChar('>');
+    }else{
+        closure->function->name->print(out, false);
+    }
+}
+
+void ObjMemo::gcMarkRefs() {
+    closure->gcMark();
+    for( Entry & entry : entries_ ){
+        for( Value & v : entry.key ) v.gcMark();
+        entry.result.gcMark();
+    }
+    for( Call & call : running_ ){
+        for( Value & v : call.key ) v.gcMark();
+    }
+}
+
+size_t ObjMemo::KeyHash::operator()(Key const * key) const {
+    uint64_t h = key->size();
+    for( Value const & v : *key ){
+        uint64_t bits = 0;
+        switch( v.type ){
+            case Value::NUMBER: memcpy(&bits, &v.as.number, sizeof(bits)); break;
+            case Value::BOOL:   bits = v.as.boolean; break;
+            case Value::TYPEID: bits = (uint64_t)v.as.typeId; break;
+            case Value::STRING: bits = (uint64_t)(uintptr_t)v.as.obj; break;
+            default:            break;
+        }
+        h = (h ^ bits ^ ((uint64_t)v.type << 56)) * 0x9E3779B97F4A7C15u;
+        h ^= h >> 29;
+    }
+    return (size_t)h;
+}
+
+bool ObjMemo::KeyEqual::operator()(Key const * a, Key const * b) const {
+    if( a->size() != b->size() ) return false;
+    for( size_t i = 0; i < a->size(); i++ ){
+        Value const & x = (*a)[i];
+        Value const & y = (*b)[i];
+        if( x.type != y.type ) return false;
+        // bitwise for numbers: -0 and 0 are different calls, and NaN is the same as itself
+        if( x.type == Value::NUMBER ){
+            if( memcmp(&x.as.number, &y.as.number, sizeof(double)) != 0 ) return false;
+        }else if( !x.equals(y) ){
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ObjMemo::lookup(Value * args, int argCount, Value & result) {
+    key_.assign(args, args + argCount);
+    isKeyCacheable_ = true;
+    for( Value & v : key_ ){
+        if( !v.isNil() && !v.isBoolean() && !v.isNumber() && !v.isString() && !v.isTypeId() ){
+            isKeyCacheable_ = false;
+            break;
+        }
+    }
+
+    if( isKeyCacheable_ ){
+        auto found = index_.find(&key_);
+        if( found != index_.end() ){
+            // now the most recently used:
+            entries_.splice(entries_.begin(), entries_, found->second);
+            result = found->second->result;
+            hits++;
+            return true;
+        }
+    }
+    misses++;
+    return false;
+}
+
+void ObjMemo::beginCall() {
+    running_.push_back(Call());
+    running_.back().isCacheable = isKeyCacheable_;
+    if( isKeyCacheable_ ) running_.back().key.swap(key_);
+}
+
+void ObjMemo::endCall(Value result) {
+    Key key;
+    key.swap(running_.back().key);
+    bool isCacheable = running_.back().isCacheable;
+    running_.pop_back();
+    if( !isCacheable ) return;
+
+    // The call may have been made again (and finished) while this one ran:
+    auto found = index_.find(&key);
+    if( found != index_.end() ){
+        found->second->result = result;
+        return;
+    }
+
+    entries_.push_front(Entry());
+    Entry & entry = entries_.front();
+    entry.key.swap(key);
+    entry.result = result;
+    index_[&entry.key] = entries_.begin();
+
+    if( capacity > 0 && (int)entries_.size() > capacity ){
+        index_.erase(&entries_.back().key);
+        entries_.pop_back();
+    }
+}
+
+void ObjMemo::abandonCalls() {
+    running_.clear();
+}
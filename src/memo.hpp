@@ -0,0 +1,74 @@
+#pragma once
+
+#include "value.hpp"
+#include "object.hpp"
+
+#include <stddef.h>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * A closure wrapped with a cache of its results, made by memo(fn[, capacity]).
+ *
+ * Calls are keyed on their arguments when they are all nil, bools, numbers or strings:
+ * numbers compare by their bits and strings by their (interned) pointer.
+ * Other calls always run the closure.
+ * With a capacity, the least recently used result is dropped to make room for a new one.
+ */
+class ObjMemo : public Obj {
+public:
+    ObjMemo(Mem * mem, ObjClosure * closure, int capacity);
+    ~ObjMemo();
+
+    // implment Obj interface
+    virtual ObjString * toString() override;
+    virtual void print(OutputStream * out, bool verbose) override;
+    virtual void gcMarkRefs() override;
+
+    /**
+     * Look up the result of a call with the given arguments
+     * @return false if the closure has to run
+     */
+    bool lookup(Value * args, int argCount, Value & result);
+
+    // The closure is now running for the arguments last passed to lookup()
+    void beginCall();
+
+    // The innermost running call returned result
+    void endCall(Value result);
+
+    // Forget the running calls, after a runtime error unwound them
+    void abandonCalls();
+
+    ObjClosure * closure;
+    int capacity;  // 0 for no limit
+    int hits, misses;
+    int size() { return (int)entries_.size(); }
+
+private:
+    typedef std::vector<Value> Key;
+
+    struct Entry {
+        Key key;
+        Value result;
+    };
+
+    struct Call {
+        Key key;
+        bool isCacheable;
+    };
+
+    struct KeyHash {
+        size_t operator()(Key const * key) const;
+    };
+    struct KeyEqual {
+        bool operator()(Key const * a, Key const * b) const;
+    };
+
+    std::list<Entry> entries_;  // most recently used first
+    std::unordered_map<Key const *, std::list<Entry>::iterator, KeyHash, KeyEqual> index_;
+    Key key_;                    // arguments of the last lookup
+    bool isKeyCacheable_;
+    std::vector<Call> running_;  // calls still running, innermost last
+};
@@ -0,0 +1,219 @@
+#include "natives.hpp"
+#include "vm.hpp"
+#include "str.hpp"
+#include "list.hpp"
+#include "floatarray.hpp"
+#include "number.hpp"
+#include "function.hpp"
+#include "memo.hpp"
+
+#include <math.h>
+#include <time.h>
+
+
+static bool len_(Vm * vm, int argCount, Value * args, Value * result) {
+    switch( args[0].type ){
+        case Value::STRING:      *result = Value::number(args[0].asObjString()->getLength()); return true;
+        case Value::LIST:        *result = Value::number(args[0].asObjList()->len()); return true;
+        case Value::FLOAT_ARRAY: *result = Value::number(args[0].asObjFloatArray()->len()); return true;
+        default:
+            return vm->nativeError("Cannot take the length of %s", Value::typeToString(args[0].type));
+    }
+}
+
+static bool num_(Vm * vm, int argCount, Value * args, Value * result) {
+    if( args[0].isNumber() ){
+        *result = args[0];
+        return true;
+    }
+    if( !args[0].isString() ){
+        return vm->nativeError("Cannot make a number from %s", Value::typeToString(args[0].type));
+    }
+    ObjString * str = args[0].asObjString();
+    double n;
+    *result = Number::parse(str->get(), str->getLength(), &n) ? Value::number(n) : Value::nil();
+    return true;
+}
+
+static bool clock_(Vm * vm, int argCount, Value * args, Value * result) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    *result = Value::number((double)ts.tv_sec + (double)ts.tv_nsec * 1e-9);
+    return true;
+}
+
+static bool flush_(Vm * vm, int argCount, Value * args, Value * result) {
+    vm->flushOutput();
+    *result = Value::nil();
+    return true;
+}
+
+static bool append_(Vm * vm, int argCount, Value * args, Value * result) {
+    if( !args[0].isList() ){
+        return vm->nativeError("Cannot append to %s", Value::typeToString(args[0].type));
+    }
+    // in place, so building a list one value at a time doesn't copy it each time:
+    args[0].asObjList()->append(args[1]);
+    *result = args[0];
+    return true;
+}
+
+// Float arrays:
+
+static bool floats_(Vm * vm, int argCount, Value * args, Value * result) {
+    Value a = args[0];
+    ObjFloatArray * array;
+    if( a.isNumber() ){
+        double n = a.as.number;
+        // NaN fails every comparison, so this also rejects it:
+        if( !(n >= 0 && n <= INT32_MAX && n == floor(n)) ){
+            return vm->nativeError("Float array length must be a whole number from 0 to %i", INT32_MAX);
+        }
+        array = new ObjFloatArray(vm->getMem(), (int)n);
+    }else if( a.isList() ){
+        ObjList * list = a.asObjList();
+        array = new ObjFloatArray(vm->getMem(), list->len());
+        for( int i = 0; i < list->len(); ++i ){
+            Value v;
+            list->get(i, v);
+            if( !v.isNumber() ){
+                return vm->nativeError("Cannot store %s in a float array", Value::typeToString(v.type));
+            }
+            array->data()[i] = v.as.number;
+        }
+    }else if( a.isFloatArray() ){
+        ObjFloatArray * src = a.asObjFloatArray();
+        array = new ObjFloatArray(vm->getMem(), src->len());
+        array->scale(src, 1);
+    }else{
+        return vm->nativeError("Cannot make a float array from %s", Value::typeToString(a.type));
+    }
+    *result = Value::floatArray(array);
+    return true;
+}
+
+// @return false after reporting an error, if the argument isn't a float array
+static bool floatArrayArg_(Vm * vm, Value arg, ObjFloatArray ** array) {
+    if( !arg.isFloatArray() ){
+        return vm->nativeError("Expected a float array, got %s", Value::typeToString(arg.type));
+    }
+    *array = arg.asObjFloatArray();
+    return true;
+}
+
+static bool tolist_(Vm * vm, int argCount, Value * args, Value * result) {
+    ObjFloatArray * array;
+    if( !floatArrayArg_(vm, args[0], &array) ) return false;
+    ObjList * list = new ObjList(vm->getMem());
+    for( int i = array->len() - 1; i >= 0; --i ){
+        list->set(i, Value::number(array->data()[i]));
+    }
+    *result = Value::list(list);
+    return true;
+}
+
+static bool sum_(Vm * vm, int argCount, Value * args, Value * result) {
+    ObjFloatArray * array;
+    if( !floatArrayArg_(vm, args[0], &array) ) return false;
+    *result = Value::number(array->sum());
+    return true;
+}
+
+static bool min_(Vm * vm, int argCount, Value * args, Value * result) {
+    ObjFloatArray * array;
+    if( !floatArrayArg_(vm, args[0], &array) ) return false;
+    // empty arrays have no min:
+    *result = array->len() > 0 ? Value::number(array->min()) : Value::nil();
+    return true;
+}
+
+static bool max_(Vm * vm, int argCount, Value * args, Value * result) {
+    ObjFloatArray * array;
+    if( !floatArrayArg_(vm, args[0], &array) ) return false;
+    *result = array->len() > 0 ? Value::number(array->max()) : Value::nil();
+    return true;
+}
+
+static bool scale_(Vm * vm, int argCount, Value * args, Value * result) {
+    ObjFloatArray * array;
+    if( !floatArrayArg_(vm, args[0], &array) ) return false;
+    if( !args[1].isNumber() ){
+        return vm->nativeError("Cannot scale by %s", Value::typeToString(args[1].type));
+    }
+    ObjFloatArray * scaled = new ObjFloatArray(vm->getMem(), array->len());
+    scaled->scale(array, args[1].as.number);
+    *result = Value::floatArray(scaled);
+    return true;
+}
+
+// @return false after reporting an error, unless both arguments are float arrays of the same length
+static bool floatArrayPair_(Vm * vm, Value * args, ObjFloatArray ** a, ObjFloatArray ** b) {
+    if( !floatArrayArg_(vm, args[0], a) || !floatArrayArg_(vm, args[1], b) ) return false;
+    if( (*a)->len() != (*b)->len() ){
+        return vm->nativeError("Float array lengths differ: %i and %i", (*a)->len(), (*b)->len());
+    }
+    return true;
+}
+
+static bool dot_(Vm * vm, int argCount, Value * args, Value * result) {
+    ObjFloatArray * a, * b;
+    if( !floatArrayPair_(vm, args, &a, &b) ) return false;
+    *result = Value::number(a->dot(b));
+    return true;
+}
+
+static bool add_(Vm * vm, int argCount, Value * args, Value * result) {
+    ObjFloatArray * a, * b;
+    if( !floatArrayPair_(vm, args, &a, &b) ) return false;
+    ObjFloatArray * sum = new ObjFloatArray(vm->getMem(), a->len());
+    sum->add(a, b);
+    *result = Value::floatArray(sum);
+    return true;
+}
+
+static bool memo_(Vm * vm, int argCount, Value * args, Value * result) {
+    if( !args[0].isClosure() ){
+        return vm->nativeError("Cannot memoise %s", Value::typeToString(args[0].type));
+    }
+    int capacity = 0;
+    if( argCount > 1 ){
+        double n = args[1].isNumber() ? args[1].as.number : 0;
+        if( !(n >= 1 && n <= INT32_MAX && n == floor(n)) ){
+            return vm->nativeError("Memo capacity must be a positive whole number");
+        }
+        capacity = (int)n;
+    }
+    *result = Value::memo(new ObjMemo(vm->getMem(), args[0].asObjClosure(), capacity));
+    return true;
+}
+
+static bool memostats_(Vm * vm, int argCount, Value * args, Value * result) {
+    if( !args[0].isMemo() ){
+        return vm->nativeError("Cannot take memo stats of %s", Value::typeToString(args[0].type));
+    }
+    ObjMemo * memo = args[0].asObjMemo();
+    ObjList * stats = new ObjList(vm->getMem());
+    stats->append(Value::number(memo->hits));
+    stats->append(Value::number(memo->misses));
+    stats->append(Value::number(memo->size()));
+    *result = Value::list(stats);
+    return true;
+}
+
+void defineNatives(Vm * vm) {
+    vm->defineNative("len", 1, 1, len_);
+    vm->defineNative("num", 1, 1, num_);
+    vm->defineNative("clock", 0, 0, clock_);
+    vm->defineNative("flush", 0, 0, flush_);
+    vm->defineNative("append", 2, 2, append_);
+    vm->defineNative("floats", 1, 1, floats_);
+    vm->defineNative("tolist", 1, 1, tolist_);
+    vm->defineNative("sum", 1, 1, sum_);
+    vm->defineNative("min", 1, 1, min_);
+    vm->defineNative("max", 1, 1, max_);
+    vm->defineNative("dot", 2, 2, dot_);
+    vm->defineNative("scale", 2, 2, scale_);
+    vm->defineNative("add", 2, 2, add_);
+    vm->defineNative("memo", 1, 2, memo_);
+    vm->defineNative("memostats", 1, 1, memostats_);
+}
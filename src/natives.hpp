@@ -0,0 +1,19 @@
+#pragma once
+
+class Vm;
+
+/**
+ * Built-in functions which are ordinary values rather than keywords:
+ *   len(x)                length of a string, list or float array
+ *   num(s)                the number a string holds, or nil if it isn't one
+ *   clock()               seconds since an arbitrary point, for timing
+ *   flush()               write out the output print and echo have buffered
+ *   append(list, x)       add x to the end of list in place, returning the list
+ *   floats(x)             a float array from a list, a length (of zeros) or another float array
+ *   tolist(a)             a list of a float array's values
+ *   sum(a), min(a), max(a), dot(a, b), scale(a, k), add(a, b)
+ *                         float array kernels, see ObjFloatArray
+ *   memo(fn[, capacity])  fn wrapped with a cache of its results, see ObjMemo
+ *   memostats(m)          [hits, misses, size] of a memo's cache
+ */
+void defineNatives(Vm * vm);
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Conversion between numbers and their text representation
+ */
+namespace Number {
+
+// Maximum number of characters written by format() (no null terminator)
+static int const MAX_CHARS = 32;
+
+/**
+ * Write the shortest decimal representation of n which reads back as exactly n.
+ * Does not null terminate.
+ * @return number of characters written to buf (at most MAX_CHARS)
+ */
+int format(double n, char * buf);
+
+/**
+ * Read a number as scanned from source: digits, optionally followed by '.' and more digits.
+ * chars need not be null terminated.
+ */
+double parse(char const * chars, int length);
+
+/**
+ * Read the whole of chars as a number, rounded correctly to the nearest double:
+ * an optional sign, digits with an optional '.', then an optional exponent ("e-7").
+ * chars need not be null terminated.
+ * @return false, leaving n unchanged, if chars isn't a number
+ */
+bool parse(char const * chars, int length, double * n);
+
+}
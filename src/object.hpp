@@ -3,6 +3,7 @@
 // Predeclare references
 class Mem;
 class ObjString;  // defined in str.hpp
+class OutputStream;
 
 
 class Obj {
@@ -12,7 +13,7 @@ public:
     virtual ~Obj();
 
     virtual ObjString * toString() = 0;
-    virtual void print(bool verbose) = 0;
+    virtual void print(OutputStream * out, bool verbose) = 0;
 
     // Marking protects the object being garbage collected
     void gcMark();
@@ -0,0 +1,446 @@
+#include "optimiser.hpp"
+#include "function.hpp"
+
+#include <assert.h>
+#include <algorithm>
+
+
+int Optimiser::instructionLength(Chunk * chunk, int offset) {
+    uint8_t * code = chunk->getCode();
+    switch( code[offset] ){
+        case OpCode::LITERAL:
+        case OpCode::DEFINE_GLOBAL_VAR:
+        case OpCode::DEFINE_GLOBAL_CONST:
+        case OpCode::GET_GLOBAL:
+        case OpCode::SET_GLOBAL:
+        case OpCode::GET_LOCAL:
+        case OpCode::SET_LOCAL:
+        case OpCode::GET_UPVALUE:
+        case OpCode::SET_UPVALUE:
+        case OpCode::GET_ENCLOSING:
+        case OpCode::SET_ENCLOSING:
+        case OpCode::MAKE_LIST:
+        case OpCode::CALL:
+        case OpCode::PEEK:
+        case OpCode::POP_UNDER:
+            return 2;
+
+        case OpCode::LITERAL_LONG:
+        case OpCode::DEFINE_GLOBAL_VAR_LONG:
+        case OpCode::DEFINE_GLOBAL_CONST_LONG:
+        case OpCode::GET_GLOBAL_LONG:
+        case OpCode::SET_GLOBAL_LONG:
+            return 4;
+
+        case OpCode::JUMP:
+        case OpCode::LOOP:
+        case OpCode::JUMP_IF_TRUE:
+        case OpCode::JUMP_IF_FALSE:
+        case OpCode::JUMP_IF_TRUE_POP:
+        case OpCode::JUMP_IF_FALSE_POP:
+            return 3;
+
+        case OpCode::FOR_PREP:
+        case OpCode::FOR_PREP_INCLUSIVE:
+        case OpCode::FOR_STEP:
+            return 4;
+
+        case OpCode::JUMP_TABLE:
+            return 5;
+        case OpCode::SWITCH_STRING:{
+            // count, bits, a 2 byte hash table entry per slot, a 3 byte literal index per case:
+            int count = (code[offset + 1] << 8) | code[offset + 2];
+            return 4 + (2 << code[offset + 3]) + 3 * count;
+        }
+
+        case OpCode::CLOSURE:
+        case OpCode::CLOSURE_STACK:{
+            // followed by an (isLocal, index) pair per upvalue:
+            ObjFunction * fn = chunk->getLiteral(code[offset + 1]).asObjFunction();
+            return 2 + 2 * fn->numUpvalues;
+        }
+        case OpCode::CLOSURE_LONG:{
+            uint32_t index = ((uint32_t)code[offset + 1] << 16) | ((uint32_t)code[offset + 2] << 8) | code[offset + 3];
+            ObjFunction * fn = chunk->getLiteral(index).asObjFunction();
+            return 4 + 2 * fn->numUpvalues;
+        }
+
+        case OpCode::PUSH_ZERO:
+        case OpCode::PUSH_ONE:
+        case OpCode::NIL:
+        case OpCode::TRUE:
+        case OpCode::FALSE:
+        case OpCode::TYPE_BOOL:
+        case OpCode::TYPE_FLOAT:
+        case OpCode::TYPE_FUNCTION:
+        case OpCode::TYPE_STRING:
+        case OpCode::TYPE_TYPEID:
+        case OpCode::POP:
+        case OpCode::CLOSE_UPVALUE:
+        case OpCode::EQUAL:
+        case OpCode::NOT_EQUAL:
+        case OpCode::GREATER:
+        case OpCode::GREATER_EQUAL:
+        case OpCode::LESS:
+        case OpCode::LESS_EQUAL:
+        case OpCode::ADD:
+        case OpCode::SUBTRACT:
+        case OpCode::MULTIPLY:
+        case OpCode::DIVIDE:
+        case OpCode::NEGATE:
+        case OpCode::NOT:
+        case OpCode::PRINT:
+        case OpCode::ECHO:
+        case OpCode::TYPE:
+        case OpCode::INDEX_GET:
+        case OpCode::INDEX_SET:
+        case OpCode::RETURN:
+        case OpCode::YIELD:
+            return 1;
+
+        default:
+            return 0;
+    }
+}
+
+// Jumps end with a 2 byte distance, measured from the end of the instruction
+static bool isJump_(uint8_t op) {
+    return (op == OpCode::JUMP || op == OpCode::LOOP
+        || op == OpCode::JUMP_IF_TRUE || op == OpCode::JUMP_IF_FALSE
+        || op == OpCode::JUMP_IF_TRUE_POP || op == OpCode::JUMP_IF_FALSE_POP
+        || op == OpCode::FOR_PREP || op == OpCode::FOR_PREP_INCLUSIVE || op == OpCode::FOR_STEP);
+}
+
+static bool isBackwards_(uint8_t op) {
+    return op == OpCode::LOOP || op == OpCode::FOR_STEP;
+}
+
+// Execution never continues on to the next instruction
+static bool isUnconditional_(uint8_t op) {
+    return op == OpCode::JUMP || op == OpCode::LOOP || op == OpCode::RETURN;
+}
+
+
+Optimiser::Optimiser() {
+    chunk_ = nullptr;
+}
+
+Optimiser::~Optimiser() {
+}
+
+void Optimiser::optimise(Chunk * chunk) {
+    chunk_ = chunk;
+    if( !decode_() ){
+        // leave code we don't understand alone
+        return;
+    }
+
+    // Keep going until nothing changes, as each rewrite can expose another:
+    bool changed = true;
+    while( changed ){
+        changed = false;
+        if( findReachable_() ) changed = true;
+        if( threadJumps_() ) changed = true;
+        if( findReachable_() ) changed = true;
+        if( rewritePatterns_() ) changed = true;
+    }
+
+    compact_();
+    instrs_.clear();
+}
+
+bool Optimiser::useEnclosingSlots(Chunk * chunk, uint8_t const * captures) {
+    chunk_ = chunk;
+    bool ok = decode_();
+
+    // Closures made in the chunk mustn't enclose its upvalues, as there won't be any:
+    for( size_t i = 0; ok && i < instrs_.size(); ++i ){
+        uint8_t op = opAt_((int)i);
+        if( op != OpCode::CLOSURE && op != OpCode::CLOSURE_LONG && op != OpCode::CLOSURE_STACK ) continue;
+        Instruction & instr = instrs_[i];
+        int operands = instr.offset + (op == OpCode::CLOSURE_LONG ? 4 : 2);
+        for( int b = operands; b < instr.offset + instr.length; b += 2 ){
+            if( !chunk_->code[(size_t)b] ) ok = false;  // not isLocal
+        }
+    }
+
+    for( size_t i = 0; ok && i < instrs_.size(); ++i ){
+        uint8_t op = opAt_((int)i);
+        if( op != OpCode::GET_UPVALUE && op != OpCode::SET_UPVALUE ) continue;
+        uint8_t & arg = chunk_->code[(size_t)instrs_[i].offset + 1];
+        setOpAt_((int)i, op == OpCode::GET_UPVALUE ? OpCode::GET_ENCLOSING : OpCode::SET_ENCLOSING);
+        arg = captures[2*arg + 1];
+    }
+
+    instrs_.clear();
+    return ok;
+}
+
+bool Optimiser::decode_() {
+    instrs_.clear();
+    int count = chunk_->count();
+    std::vector<int> indexAt((size_t)count + 1, -1);
+
+    for( int offset = 0; offset < count; ){
+        int length = instructionLength(chunk_, offset);
+        if( length == 0 || offset + length > count ) return false;
+        indexAt[(size_t)offset] = (int)instrs_.size();
+        instrs_.push_back({offset, length, -1, 0, false, false});
+        offset += length;
+    }
+
+    // The jumps after a switch are chosen by position, so they mustn't move or change size:
+    int n = (int)instrs_.size();
+    for( int i = 0; i < n; ++i ){
+        int entries = numEntries_(i);
+        if( i + entries >= n ) return false;
+        for( int e = i + 1; e <= i + entries; ++e ){
+            if( opAt_(e) != OpCode::JUMP && opAt_(e) != OpCode::LOOP ) return false;
+            instrs_[(size_t)e].isTableEntry = true;
+        }
+    }
+
+    // Convert relative jump distances to the instruction they land on:
+    for( Instruction & instr : instrs_ ){
+        uint8_t * code = chunk_->getCode() + instr.offset;
+        if( !isJump_(code[0]) ) continue;
+
+        int end = instr.offset + instr.length;
+        int distance = (code[instr.length - 2] << 8) | code[instr.length - 1];
+        int dest = end + (isBackwards_(code[0]) ? -distance : distance);
+        if( dest < 0 || dest >= count || indexAt[(size_t)dest] == -1 ) return false;
+        instr.target = indexAt[(size_t)dest];
+    }
+    return true;
+}
+
+int Optimiser::numEntries_(int i) {
+    uint8_t * code = chunk_->getCode() + instrs_[(size_t)i].offset;
+    switch( code[0] ){
+        case OpCode::JUMP_TABLE:    return ((code[3] << 8) | code[4]) + 1;
+        case OpCode::SWITCH_STRING: return ((code[1] << 8) | code[2]) + 1;
+        default:                    return 0;
+    }
+}
+
+int Optimiser::next_(int i) {
+    int n = (int)instrs_.size();
+    for( ++i; i < n; ++i ){
+        if( !instrs_[(size_t)i].isRemoved ) return i;
+    }
+    return n;
+}
+
+bool Optimiser::findReachable_() {
+    int n = (int)instrs_.size();
+    std::vector<bool> isReachable((size_t)n, false);
+    std::vector<int> pending;
+
+    for( Instruction & instr : instrs_ ){
+        instr.numSources = 0;
+        // jumps can't land on removed code, only on whatever follows it:
+        if( instr.target != -1 && instrs_[(size_t)instr.target].isRemoved ){
+            instr.target = next_(instr.target);
+        }
+    }
+
+    // Follow every path from the start of the chunk:
+    int first = instrs_.empty() || !instrs_[0].isRemoved ? 0 : next_(0);
+    if( first < n ){
+        isReachable[(size_t)first] = true;
+        pending.push_back(first);
+    }
+    while( !pending.empty() ){
+        int i = pending.back();
+        pending.pop_back();
+        Instruction & instr = instrs_[(size_t)i];
+
+        int successors[2] = {-1, -1};
+        if( instr.target != -1 ){
+            instrs_[(size_t)instr.target].numSources++;
+            successors[0] = instr.target;
+        }
+        if( !isUnconditional_(opAt_(i)) ){
+            successors[1] = next_(i);
+        }
+        for( int s : successors ){
+            if( s != -1 && s < n && !isReachable[(size_t)s] ){
+                isReachable[(size_t)s] = true;
+                pending.push_back(s);
+            }
+        }
+        // a switch can go to any of its jumps:
+        int entries = numEntries_(i);
+        for( int e = i + 1; e <= i + entries; ++e ){
+            if( !isReachable[(size_t)e] ){
+                isReachable[(size_t)e] = true;
+                pending.push_back(e);
+            }
+        }
+    }
+
+    // Remove everything else:
+    bool changed = false;
+    for( int i = 0; i < n; ++i ){
+        Instruction & instr = instrs_[(size_t)i];
+        if( !isReachable[(size_t)i] && !instr.isRemoved ){
+            instr.isRemoved = true;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+bool Optimiser::threadJumps_() {
+    bool changed = false;
+    int n = (int)instrs_.size();
+    for( int i = 0; i < n; ++i ){
+        Instruction & instr = instrs_[(size_t)i];
+        if( instr.isRemoved || instr.target == -1 ) continue;
+        uint8_t op = opAt_(i);
+        bool isConditional = !isUnconditional_(op);
+
+        // Follow the chain of jumps (a limited distance, as jumps can form cycles):
+        for( int hops = 0; hops < 16; ++hops ){
+            int t = instr.target;
+            uint8_t targetOp = opAt_(t);
+            int dest = -1;
+            if( targetOp == OpCode::JUMP || targetOp == OpCode::LOOP ){
+                dest = instrs_[(size_t)t].target;
+            }else if( (op == OpCode::JUMP_IF_TRUE || op == OpCode::JUMP_IF_FALSE) && targetOp == op ){
+                // the value is still on the stack, so the same condition jumps again:
+                dest = instrs_[(size_t)t].target;
+            }else if( (op == OpCode::JUMP_IF_TRUE && targetOp == OpCode::JUMP_IF_FALSE)
+                    || (op == OpCode::JUMP_IF_FALSE && targetOp == OpCode::JUMP_IF_TRUE) ){
+                // ...and the opposite condition never jumps:
+                dest = next_(t);
+            }
+
+            // conditional jumps can only go forwards:
+            if( dest == -1 || dest == t || dest >= n || (isConditional && dest <= i) ) break;
+            instr.target = dest;
+            changed = true;
+        }
+
+        // A jump to the next instruction does nothing:
+        if( (op == OpCode::JUMP || op == OpCode::LOOP) && instr.target == next_(i) && !instr.isTableEntry ){
+            instr.isRemoved = true;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+bool Optimiser::rewritePatterns_() {
+    bool changed = false;
+    int n = (int)instrs_.size();
+    for( int i = next_(-1); i < n; i = next_(i) ){
+        uint8_t op = opAt_(i);
+        int j = next_(i);
+        if( j >= n ) break;
+
+        // NOT, JUMP_IF_FALSE_POP  -->  JUMP_IF_TRUE_POP
+        // unless something jumps straight to the jump, skipping the NOT
+        if( op == OpCode::NOT && instrs_[(size_t)j].numSources == 0 ){
+            uint8_t jumpOp = opAt_(j);
+            if( jumpOp == OpCode::JUMP_IF_FALSE_POP || jumpOp == OpCode::JUMP_IF_TRUE_POP ){
+                setOpAt_(j, jumpOp == OpCode::JUMP_IF_FALSE_POP ? OpCode::JUMP_IF_TRUE_POP : OpCode::JUMP_IF_FALSE_POP);
+                instrs_[(size_t)i].isRemoved = true;
+                changed = true;
+                continue;
+            }
+        }
+
+        // SET_LOCAL n, POP, GET_LOCAL n  -->  SET_LOCAL n
+        // the value assigned is still on the stack
+        if( op == OpCode::SET_LOCAL || op == OpCode::SET_UPVALUE || op == OpCode::SET_GLOBAL ){
+            int k = next_(j);
+            if( k >= n || opAt_(j) != OpCode::POP ) continue;
+            if( instrs_[(size_t)j].numSources != 0 || instrs_[(size_t)k].numSources != 0 ) continue;
+
+            uint8_t getOp = op == OpCode::SET_LOCAL ? OpCode::GET_LOCAL
+                : op == OpCode::SET_UPVALUE ? OpCode::GET_UPVALUE : OpCode::GET_GLOBAL;
+            if( opAt_(k) == getOp && argAt_(k) == argAt_(i) ){
+                instrs_[(size_t)j].isRemoved = true;
+                instrs_[(size_t)k].isRemoved = true;
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+void Optimiser::compact_() {
+    int n = (int)instrs_.size();
+
+    // New position of each instruction (removed instructions take the position of the next one):
+    std::vector<int> newOffset((size_t)n + 1);
+    int position = 0;
+    for( int i = 0; i < n; ++i ){
+        newOffset[(size_t)i] = position;
+        if( !instrs_[(size_t)i].isRemoved ) position += instrs_[(size_t)i].length;
+    }
+    newOffset[(size_t)n] = position;
+
+    // Line of each instruction, looked up before the line table is rebuilt:
+    std::vector<uint16_t> instrLines((size_t)n);
+    for( int i = 0; i < n; ++i ){
+        instrLines[(size_t)i] = chunk_->getLineNumber(instrs_[(size_t)i].offset);
+    }
+    chunk_->lines.clear();
+
+    std::vector<uint8_t> code;
+    code.reserve((size_t)position);
+
+    for( int i = 0; i < n; ++i ){
+        Instruction & instr = instrs_[(size_t)i];
+        if( instr.isRemoved ) continue;
+        chunk_->addLine_((int)code.size(), instrLines[(size_t)i]);
+
+        if( instr.target != -1 ){
+            uint8_t op = opAt_(i);
+            int from = newOffset[(size_t)i] + instr.length;
+            int to = newOffset[(size_t)instr.target];
+            // threading can turn a jump backwards, or a loop forwards:
+            if( op == OpCode::JUMP || op == OpCode::LOOP ){
+                op = to >= from ? OpCode::JUMP : OpCode::LOOP;
+            }
+            int distance = to >= from ? to - from : from - to;
+            assert(distance <= UINT16_MAX);
+            assert(to >= from || isBackwards_(op));
+            assert(to < from || !isBackwards_(op));
+
+            code.push_back(op);
+            for( int b = 1; b < instr.length - 2; ++b ){
+                code.push_back(chunk_->code[(size_t)(instr.offset + b)]);
+            }
+            code.push_back((uint8_t)(distance >> 8));
+            code.push_back((uint8_t)(distance & 0xFF));
+        }else{
+            for( int b = 0; b < instr.length; ++b ){
+                code.push_back(chunk_->code[(size_t)(instr.offset + b)]);
+            }
+        }
+    }
+
+    chunk_->code.swap(code);
+
+    // Inlined calls keep the instructions that are left of their bodies:
+    std::vector<InlinedCall> & calls = chunk_->inlinedCalls;
+    size_t kept = 0;
+    for( InlinedCall call : calls ){
+        call.start = (uint16_t)newOffset[(size_t)instrAt_(call.start)];
+        call.end = (uint16_t)newOffset[(size_t)instrAt_(call.end)];
+        if( call.start < call.end ) calls[kept++] = call;
+    }
+    calls.resize(kept);
+}
+
+int Optimiser::instrAt_(int offset) {
+    int n = (int)instrs_.size();
+    if( offset >= instrs_[(size_t)n - 1].offset + instrs_[(size_t)n - 1].length ) return n;
+    auto found = std::lower_bound(instrs_.begin(), instrs_.end(), offset,
+        [](Instruction const & instr, int offset){ return instr.offset < offset; });
+    assert(found != instrs_.end() && found->offset == offset);
+    return (int)(found - instrs_.begin());
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "chunk.hpp"
+
+#include <vector>
+
+/**
+ * Peephole optimiser which rewrites a chunk's bytecode once it has been compiled:
+ *  - removes code which can't be reached
+ *  - threads jumps which land on other jumps
+ *  - SET_LOCAL n, POP, GET_LOCAL n  -->  SET_LOCAL n  (and for upvalues and globals)
+ *  - NOT, JUMP_IF_FALSE_POP  -->  JUMP_IF_TRUE_POP  (and vice versa)
+ * then compacts the code, keeping jump offsets and line numbers consistent.
+ */
+class Optimiser {
+public:
+    Optimiser();
+    ~Optimiser();
+
+    void optimise(Chunk * chunk);
+
+    /**
+     * Make a function read its upvalues from the slots of the frame which made its closure:
+     *   GET_UPVALUE i  -->  GET_ENCLOSING slot  (and SET)
+     * @param captures the (isLocal, slot) pair of each upvalue, from the CLOSURE instruction
+     * @return false, leaving the chunk unchanged, if a closure within it encloses the upvalues
+     */
+    bool useEnclosingSlots(Chunk * chunk, uint8_t const * captures);
+
+    /**
+     * Number of bytes taken by the instruction at offset, or 0 if not known.
+     * A CLOSURE's literal must already be a function, and a SWITCH_STRING's count and bits must be in the code.
+     */
+    static int instructionLength(Chunk * chunk, int offset);
+
+private:
+    struct Instruction {
+        int offset;      // position in the original code
+        int length;      // in bytes, including operands
+        int target;      // index of the instruction jumped to, or -1 if not a jump
+        int numSources;  // number of reachable jumps which land here
+        bool isRemoved;
+        bool isTableEntry;  // one of the jumps following a switch, which must stay in place
+    };
+
+    bool decode_();
+    int next_(int i);  // index of the next instruction which hasn't been removed
+    int numEntries_(int i);  // number of jumps following a switch instruction, 0 for others
+    bool findReachable_();  // removes unreachable code
+    bool threadJumps_();
+    bool rewritePatterns_();
+    void compact_();
+    int instrAt_(int offset);  // index of the instruction at an offset of the original code, or the count at its end
+
+    uint8_t opAt_(int i) { return chunk_->code[(size_t)instrs_[(size_t)i].offset]; }
+    void setOpAt_(int i, uint8_t op) { chunk_->code[(size_t)instrs_[(size_t)i].offset] = op; }
+    uint8_t argAt_(int i) { return chunk_->code[(size_t)instrs_[(size_t)i].offset + 1]; }
+
+    Chunk * chunk_;
+    std::vector<Instruction> instrs_;
+};
@@ -0,0 +1,11 @@
+#pragma once
+
+/**
+ * Settings chosen on the command line, shared by the compiler and vm
+ */
+struct Options {
+    bool disassemble = false;  // print the bytecode of each function once compiled
+    bool optimise = true;      // run the peephole optimiser over compiled bytecode
+    bool useCache = true;      // load and save compiled scripts next to their source
+    bool lazy = false;         // compile function bodies when first called
+};
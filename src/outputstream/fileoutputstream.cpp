@@ -0,0 +1,46 @@
+
+#include "fileoutputstream.hpp"
+
+#include <errno.h>
+#include <unistd.h>
+
+
+FileOutputStream::FileOutputStream(int fd) {
+  fd_ = fd;
+  len_ = 0;
+}
+
+FileOutputStream::~FileOutputStream() {
+  flush();
+}
+
+void FileOutputStream::write(char const * str, int len) {
+  if( len_ + len > BUF_SIZE ){
+    flush();
+  }
+  if( len >= BUF_SIZE ){
+    // too big to be worth buffering:
+    writeAll_(str, len);
+    return;
+  }
+  memcpy(&buf_[len_], str, (size_t)len);
+  len_ += len;
+}
+
+void FileOutputStream::flush() {
+  writeAll_(buf_, len_);
+  len_ = 0;
+}
+
+void FileOutputStream::writeAll_(char const * str, int len) {
+  // write() may accept fewer characters than asked, so keep going:
+  while( len > 0 ){
+    ssize_t n = ::write(fd_, str, (size_t)len);
+    if( n < 0 ){
+      if( errno == EINTR ) continue;
+      return;  // nowhere left to send the output
+    }
+    str += n;
+    len -= (int)n;
+  }
+}
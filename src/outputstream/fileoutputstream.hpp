@@ -0,0 +1,28 @@
+#pragma once
+
+#include "outputstream.hpp"
+
+
+/**
+ * Buffered output to a file descriptor.
+ * Characters are only written out when the buffer fills up or on flush()
+ */
+class FileOutputStream : public OutputStream {
+public:
+  FileOutputStream(int fd);
+
+  virtual ~FileOutputStream();
+
+  virtual void write(char const * str, int len) override;
+
+  virtual void flush() override;
+
+private:
+  void writeAll_(char const * str, int len);
+
+  static int const BUF_SIZE = 64 * 1024;
+
+  int fd_;
+  int len_;  // number of characters waiting in the buffer
+  char buf_[BUF_SIZE];
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+
+class OutputStream {
+public:
+  virtual ~OutputStream() {}
+
+  /**
+   * write len characters from str
+   */
+  virtual void write(char const * str, int len) = 0;
+
+  /**
+   * push any buffered characters out to the destination
+   */
+  virtual void flush() = 0;
+
+  /**
+   * write a single character
+   */
+  void writeChar(char c) { write(&c, 1); }
+
+  /**
+   * write a null terminated string
+   */
+  void writeString(char const * str) { write(str, (int)strlen(str)); }
+};
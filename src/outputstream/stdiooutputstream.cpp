@@ -0,0 +1,23 @@
+
+#include "stdiooutputstream.hpp"
+
+
+StdioOutputStream::StdioOutputStream(FILE * file) {
+  file_ = file;
+}
+
+StdioOutputStream::~StdioOutputStream() {
+}
+
+void StdioOutputStream::write(char const * str, int len) {
+  fwrite(str, 1, (size_t)len, file_);
+}
+
+void StdioOutputStream::flush() {
+  fflush(file_);
+}
+
+StdioOutputStream * StdioOutputStream::getStdout() {
+  static StdioOutputStream stream(stdout);
+  return &stream;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "outputstream.hpp"
+
+#include <stdio.h>
+
+
+/**
+ * Output to a stdio FILE, for use alongside printf (e.g. debug output)
+ */
+class StdioOutputStream : public OutputStream {
+public:
+  StdioOutputStream(FILE * file);
+
+  virtual ~StdioOutputStream();
+
+  virtual void write(char const * str, int len) override;
+
+  virtual void flush() override;
+
+  // Shared stream for stdout, e.g. for debug printing
+  static StdioOutputStream * getStdout();
+
+private:
+  FILE * file_;
+};
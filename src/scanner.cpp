@@ -4,6 +4,152 @@
 #include <string.h>
 #include <stdio.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+//-----------------------------------------------------------------------------
+// Runs of characters, skipped 16 bytes at a time where SSE2 is available (every x86-64 cpu).
+// Each returns the end of the run starting at p, stopping at end or a null character.
+//-----------------------------------------------------------------------------
+
+#if defined(__SSE2__)
+typedef __m128i Block_;
+static int const BLOCK_SIZE_ = 16;
+static uint32_t const BLOCK_MASK_ = 0xFFFF;
+static inline Block_ load_(char const * p) { return _mm_loadu_si128((Block_ const *)p); }
+static inline uint32_t bits_(Block_ b) { return (uint32_t)_mm_movemask_epi8(b); }
+static inline Block_ splat_(char c) { return _mm_set1_epi8(c); }
+static inline Block_ or_(Block_ a, Block_ b) { return _mm_or_si128(a, b); }
+static inline Block_ and_(Block_ a, Block_ b) { return _mm_and_si128(a, b); }
+static inline Block_ eq_(Block_ b, char c) { return _mm_cmpeq_epi8(b, splat_(c)); }
+static inline Block_ gt_(Block_ b, char c) { return _mm_cmpgt_epi8(b, splat_(c)); }
+static inline Block_ lt_(Block_ b, char c) { return _mm_cmpgt_epi8(splat_(c), b); }
+#define SCANNER_SIMD_
+#endif
+
+char const * Scanner::skipIdentifierChars_(char const * p, char const * end) {
+#ifdef SCANNER_SIMD_
+    for( ; end - p >= BLOCK_SIZE_; p += BLOCK_SIZE_ ){
+        Block_ b = load_(p);
+        // letters of either case: bytes over 0x7F are negative, so never in range
+        Block_ lower = or_(b, splat_(0x20));
+        Block_ letter = and_(gt_(lower, 'a' - 1), lt_(lower, 'z' + 1));
+        Block_ digit = and_(gt_(b, '0' - 1), lt_(b, '9' + 1));
+        uint32_t other = BLOCK_MASK_ & ~bits_(or_(or_(letter, digit), eq_(b, '_')));
+        if( other != 0 ) return p + __builtin_ctz(other);
+    }
+#endif
+    while( p < end && (isAlpha_(*p) || isDigit_(*p)) ) p++;
+    return p;
+}
+
+// Also counts the newlines in the run, and finds the last one
+static char const * skipWhitespaceChars_(char const * p, char const * end, int & newlines, char const * & lastNewline) {
+#ifdef SCANNER_SIMD_
+    for( ; end - p >= BLOCK_SIZE_; p += BLOCK_SIZE_ ){
+        Block_ b = load_(p);
+        uint32_t nl = bits_(eq_(b, '\n'));
+        uint32_t other = BLOCK_MASK_ & ~(nl | bits_(or_(or_(eq_(b, ' '), eq_(b, '\t')), eq_(b, '\r'))));
+        int run = other != 0 ? __builtin_ctz(other) : BLOCK_SIZE_;
+        if( other != 0 ) nl &= (1u << run) - 1;  // only the newlines within the run
+        if( nl != 0 ){
+            newlines += __builtin_popcount(nl);
+            lastNewline = p + 31 - __builtin_clz(nl);
+        }
+        if( other != 0 ) return p + run;
+    }
+#endif
+    for( ; p < end; p++ ){
+        if( *p == '\n' ){
+            newlines++;
+            lastNewline = p;
+        }else if( *p != ' ' && *p != '\t' && *p != '\r' ){
+            break;
+        }
+    }
+    return p;
+}
+
+// Up to (not including) the first stop character, or a null character
+static char const * skipUntil_(char const * p, char const * end, char stop1, char stop2) {
+#ifdef SCANNER_SIMD_
+    for( ; end - p >= BLOCK_SIZE_; p += BLOCK_SIZE_ ){
+        Block_ b = load_(p);
+        uint32_t stops = bits_(or_(or_(eq_(b, stop1), eq_(b, stop2)), eq_(b, '\0')));
+        if( stops != 0 ) return p + __builtin_ctz(stops);
+    }
+#endif
+    while( p < end && *p != stop1 && *p != stop2 && *p != '\0' ) p++;
+    return p;
+}
+
+//-----------------------------------------------------------------------------
+// Keywords, found with a perfect hash table built at compile time from SCANNER_KEYWORDS
+//-----------------------------------------------------------------------------
+
+struct Keyword_ {
+    Token::Type type;
+    char const * text;
+    uint32_t length;
+};
+
+static constexpr Keyword_ KEYWORDS_[] = {
+#define KEYWORD_ENTRY_(type, text) {Token::type, text, sizeof(text) - 1},
+    SCANNER_KEYWORDS(KEYWORD_ENTRY_)
+#undef KEYWORD_ENTRY_
+};
+
+static int const KEYWORD_BITS_ = 7;
+static int const KEYWORD_SLOTS_ = 1 << KEYWORD_BITS_;
+static_assert(sizeof(KEYWORDS_) / sizeof(Keyword_) <= KEYWORD_SLOTS_ / 2, "Too many keywords for the hash table");
+
+static constexpr uint32_t maxKeywordLength_() {
+    uint32_t max = 0;
+    for( Keyword_ const & keyword : KEYWORDS_ ){
+        if( keyword.length > max ) max = keyword.length;
+    }
+    return max;
+}
+
+static constexpr uint32_t MAX_KEYWORD_LENGTH_ = maxKeywordLength_();
+
+// Mixes the first, middle and last characters and the length, keeping the top bits of the product
+static constexpr uint32_t keywordHash_(char const * chars, uint32_t length, uint32_t seed) {
+    uint32_t key = (uint32_t)(uint8_t)chars[0] | (uint32_t)(uint8_t)chars[length >> 1] << 8 |
+        (uint32_t)(uint8_t)chars[length - 1] << 16 | length << 24;
+    return (key * seed) >> (32 - KEYWORD_BITS_);
+}
+
+struct KeywordTable_ {
+    uint32_t seed;  // 0 if no seed gives each keyword its own slot
+    Keyword_ slots[KEYWORD_SLOTS_];
+};
+
+// Try odd multipliers until every keyword hashes to a different slot
+static constexpr KeywordTable_ makeKeywordTable_() {
+    for( uint32_t i = 0; i < 10000; ++i ){
+        KeywordTable_ table = {};
+        table.seed = (i * 0x9E3779B9u) | 1;
+        bool isPerfect = true;
+        for( Keyword_ const & keyword : KEYWORDS_ ){
+            Keyword_ & slot = table.slots[keywordHash_(keyword.text, keyword.length, table.seed)];
+            if( slot.length != 0 ){
+                isPerfect = false;
+                break;
+            }
+            slot = keyword;
+        }
+        if( isPerfect ) return table;
+    }
+    return KeywordTable_{};
+}
+
+static constexpr KeywordTable_ KEYWORD_TABLE_ = makeKeywordTable_();
+static_assert(KEYWORD_TABLE_.seed != 0, "Keywords collide in the hash table: change keywordHash_");
+
+
 
 Scanner::Scanner() {
 }
@@ -11,12 +157,24 @@ Scanner::Scanner() {
 Scanner::~Scanner() {
 }
 
-void Scanner::init(Mem * mem, InputStream * stream) {
-    mem_ = mem;
+void Scanner::init(InputStream * stream, uint16_t line, uint16_t col, uint32_t offset) {
     stream_ = stream;
-    line_ = 1;
-    col_ = 0;
-    tokenStrLen_ = 0;
+    line_ = line;
+    col_ = col;
+
+    size_t length;
+    source_ = stream->getBuffer(length);
+    if( source_ == nullptr ){
+        copy_.clear();
+        for( char c = stream->next(); c != '\0'; c = stream->next() ){
+            copy_.push_back(c);
+        }
+        source_ = copy_.data();
+        length = copy_.size();
+    }
+    end_ = source_ + length;
+    current_ = source_ + (offset < length ? offset : length);
+    tokenStr_ = current_;
 }
 
 char const * Scanner::getPath() {
@@ -31,8 +189,8 @@ Token Scanner::scanToken() {
     // first, gobble up whitespace and comments:
     skipWhitespace_();
 
-    // reset token buffer:
-    tokenStrLen_ = 0;
+    // the token starts here:
+    tokenStr_ = current_;
 
     // check for EOF:
     if( isAtEnd_() ) return makeToken_(Token::END);
@@ -84,20 +242,29 @@ void Scanner::skipWhitespace_() {
     for(;;){
         switch( peek_() ){
             case '\n':
-                incrementLine_();
-                // Fall-through
             case ' ':
             case '\r':
-            case '\t':
-                nextChar_();
+            case '\t':{
+                int newlines = 0;
+                char const * lastNewline = nullptr;
+                char const * start = current_;
+                current_ = skipWhitespaceChars_(current_, end_, newlines, lastNewline);
+                if( newlines > 0 ){
+                    line_ = (uint16_t)(line_ + newlines < MAX_LINES ? line_ + newlines : MAX_LINES);
+                    col_ = (uint16_t)(current_ - lastNewline);  // counting the newline, as nextChar_ would
+                }else{
+                    col_ = (uint16_t)(col_ + (current_ - start));
+                }
                 break;
+            }
 
-            case '#':
+            case '#':{
                 // comment out the rest of the line:
-                while( peek_()!='\n' && !isAtEnd_() ){
-                    nextChar_();
-                }
+                char const * start = current_;
+                current_ = skipUntil_(current_, end_, '\n', '\n');
+                col_ = (uint16_t)(col_ + (current_ - start));
                 break;
+            }
 
             default:
                 return;
@@ -106,44 +273,49 @@ void Scanner::skipWhitespace_() {
 }
 
 bool Scanner::isAtEnd_() {
-    return stream_->peek() == '\0';
+    return peek_() == '\0';
 }
 
 char Scanner::peek_() {
-    return stream_->peek();
+    // a null character ends the source too
+    return current_ < end_ ? *current_ : '\0';
 }
 
 char Scanner::nextChar_() {
-    char c = stream_->next();
+    char c = peek_();
+    if( c != '\0' ) current_++;
     col_++;
-    if( tokenStrLen_ < MAX_TOKEN_LEN ){
-        tokenStr_[tokenStrLen_++] = c;
-    }
     return c;
 }
 
 bool Scanner::matchNext_(char expected) {
     if( isAtEnd_() ) return false;  // EOF
 
-    if( stream_->peek() == expected ){
-        stream_->next();
+    if( peek_() == expected ){
+        current_++;
         return true;
     }
     return false;
 }
 
 Token Scanner::makeToken_(Token::Type type) {
-  return Token(type, line_, col_);
+  return Token(type, line_, col_, (uint32_t)(tokenStr_ - source_), (uint32_t)tokenLength_());
 }
 
 Token Scanner::makeErrorToken_(const char* message) {
-  return Token(Token::ERROR, line_, col_, ObjString::newString(mem_, message));
+  Token token(Token::ERROR, line_, col_);
+  token.message = message;
+  return token;
 }
 
 Token Scanner::makeStringToken_() {
     // TODO string escape characters
-    while( peek_() != '"' && !isAtEnd_() ){
-        if( peek_() == '\n' ) incrementLine_();
+    for(;;){
+        char const * start = current_;
+        current_ = skipUntil_(current_, end_, '"', '\n');
+        col_ = (uint16_t)(col_ + (current_ - start));
+        if( peek_() != '\n' ) break;
+        incrementLine_();
         nextChar_();
     }
 
@@ -152,9 +324,8 @@ Token Scanner::makeStringToken_() {
     // consume the closing quote:
     nextChar_();
 
-    // Don't include the quotes when capturing the string value:
-    ObjString * str = ObjString::newString(mem_, tokenStr_+1, tokenStrLen_-2);
-    return Token(Token::STRING, line_, col_, str);
+    // Don't include the quotes in the string's span:
+    return Token(Token::STRING, line_, col_, (uint32_t)(tokenStr_ + 1 - source_), (uint32_t)tokenLength_() - 2);
 }
 
 Token Scanner::makeNumberToken_() {
@@ -176,109 +347,24 @@ Token Scanner::makeNumberToken_() {
             nextChar_();
         }
     }
-    // For now, simply capture the string and convert to number later:
-    ObjString * str = ObjString::newString(mem_, tokenStr_, tokenStrLen_);
-    return Token(Token::NUMBER, line_, col_, str);
+    // The compiler converts the text when it needs the value:
+    return makeToken_(Token::NUMBER);
 }
 
 Token Scanner::makeIdentifierToken_() {
-    while( isAlpha_(peek_()) || isDigit_(peek_()) ){
-        nextChar_();
-    }
-    Token::Type type = identifierType_();
-    // Only capture the source string if its an identifier:
-    if( type == Token::IDENTIFIER ){
-        ObjString * str = ObjString::newString(mem_, tokenStr_, tokenStrLen_);
-        return Token(type, line_, col_, str);
-    }
-    return Token(type, line_, col_);
+    char const * start = current_;
+    current_ = skipIdentifierChars_(current_, end_);
+    col_ = (uint16_t)(col_ + (current_ - start));
+    return makeToken_(identifierType_());
 }
 
 Token::Type Scanner::identifierType_() {
-    // Use a trie to determine if the identifier is a keyword:
-    switch( tokenStr_[0] ){
-        case 'a': return checkKeyword_(1, 2, "nd", Token::AND);
-        case 'b': return checkKeyword_(1, 3, "ool", Token::BOOL);
-        case 'c': return checkKeyword_(1, 4, "onst", Token::CONST);
-        case 'e': {
-            // "e..." might be "echo", "else" or "elif":
-            // check correct number of chars, and that next char is l:
-            if( tokenStrLen_ == 4 ){
-                if( tokenStr_[1] == 'c' ){
-                    return checkKeyword_(2, 2, "ho", Token::ECHO);
-                } else if( tokenStr_[1] == 'l' ){
-                    if( tokenStr_[2] == 's' && tokenStr_[3] == 'e' ) return Token::ELSE;
-                    if( tokenStr_[2] == 'i' && tokenStr_[3] == 'f' ) return Token::ELIF;
-                }
-            }
-            break;
-        }
-        case 'f': {
-            // "f..." might be "false", "for" or "fn":
-            // first check if identifier is longer than 1 char:
-            if( tokenStrLen_ > 1 ){
-                switch( tokenStr_[1] ){
-                    case 'a': return checkKeyword_(2, 3, "lse", Token::FALSE);
-                    case 'o': return checkKeyword_(2, 1, "r", Token::FOR);
-                    case 'l': return checkKeyword_(2, 3, "oat", Token::FLOAT);
-                    case 'n': return Token::FN;
-                }
-            }
-            break;
-        }
-        case 'i': {
-            if( tokenStrLen_ == 2 ){
-                switch( tokenStr_[1] ){
-                    case 'f': return Token::IF;
-                    case 'n': return Token::IN;
-                }
-            }
-            break;
-        }
-        case 'n': return checkKeyword_(1, 2, "il", Token::NIL);
-        case 'o': {
-            if( tokenStrLen_ > 1 ){
-                switch( tokenStr_[1] ){
-                    case 'b': return checkKeyword_(2, 4, "ject", Token::OBJECT);
-                    case 'r': return Token::OR;
-                }
-            }
-            break;
-        }
-        case 'p': return checkKeyword_(1, 4, "rint", Token::PRINT);
-        case 'r': return checkKeyword_(1, 5, "eturn", Token::RETURN);
-        case 's': return checkKeyword_(1, 5, "tring", Token::STRING_TYPE);
-        case 't': {
-            // could be "true", "type" or "typeid"
-            if( tokenStrLen_ > 1 ){
-                switch( tokenStr_[1] ){
-                    case 'r': return checkKeyword_(2, 2, "ue", Token::TRUE);
-                    case 'y': {
-                        if( tokenStrLen_ == 4 ){
-                            return checkKeyword_(2, 2, "pe", Token::TYPE);
-                        }else{
-                            return checkKeyword_(2, 4, "peid", Token::TYPEID);
-                        }
-                    }
-                }
-            }
-            break;
-        }
-        case 'v': return checkKeyword_(1, 2, "ar", Token::VAR);
-        case 'w': return checkKeyword_(1, 4, "hile", Token::WHILE);
-    }
-    // Not a keyword:
-    return Token::IDENTIFIER;
-}
-
-Token::Type Scanner::checkKeyword_(int offset, int len, char const * rest, Token::Type type) {
-    // check length is correct:
-    if( tokenStrLen_ == offset + len ){
-        // check string matches:
-        if( memcmp(tokenStr_ + offset, rest, len) == 0 ){
-            return type;
-        }
+    // One hash and one comparison decide whether the identifier is a keyword:
+    uint32_t length = (uint32_t)tokenLength_();
+    if( length > MAX_KEYWORD_LENGTH_ ) return Token::IDENTIFIER;
+    Keyword_ const & keyword = KEYWORD_TABLE_.slots[keywordHash_(tokenStr_, length, KEYWORD_TABLE_.seed)];
+    if( keyword.length == length && memcmp(tokenStr_, keyword.text, length) == 0 ){
+        return keyword.type;
     }
-    // Not a keyword:
     return Token::IDENTIFIER;
 }
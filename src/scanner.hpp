@@ -3,6 +3,35 @@
 #include "inputstream/inputstream.hpp"
 #include "mem.hpp"
 #include <stdint.h>
+#include <vector>
+
+// Every keyword: its token type and text. The scanner's keyword hash table is built from this list.
+#define SCANNER_KEYWORDS(KEYWORD) \
+    KEYWORD(AND, "and") \
+    KEYWORD(BOOL, "bool") \
+    KEYWORD(CONST, "const") \
+    KEYWORD(ELIF, "elif") \
+    KEYWORD(ELSE, "else") \
+    KEYWORD(FALSE, "false") \
+    KEYWORD(FOR, "for") \
+    KEYWORD(FN, "fn") \
+    KEYWORD(FLOAT, "float") \
+    KEYWORD(IF, "if") \
+    KEYWORD(IN, "in") \
+    KEYWORD(NIL, "nil") \
+    KEYWORD(OR, "or") \
+    KEYWORD(OBJECT, "object") \
+    KEYWORD(PRINT, "print") \
+    KEYWORD(ECHO, "echo") \
+    KEYWORD(RETURN, "return") \
+    KEYWORD(STRING_TYPE, "string") \
+    KEYWORD(SWITCH, "switch") \
+    KEYWORD(TRUE, "true") \
+    KEYWORD(TYPE, "type") \
+    KEYWORD(TYPEID, "typeid") \
+    KEYWORD(VAR, "var") \
+    KEYWORD(WHILE, "while") \
+    KEYWORD(YIELD, "yield")
 
 struct Token {
     enum Type : uint8_t {
@@ -22,10 +51,9 @@ struct Token {
         // Literals:
         IDENTIFIER, STRING, NUMBER,   // TODO int
         // Keywords:
-        AND, BOOL, CONST, ELIF, ELSE, FALSE,
-        FOR, FN, FLOAT, IF, IN, NIL, OR, OBJECT,
-        PRINT, ECHO, RETURN, STRING_TYPE,
-        TRUE, TYPE, TYPEID, VAR, WHILE,
+#define TOKEN_KEYWORD_(type, text) type,
+        SCANNER_KEYWORDS(TOKEN_KEYWORD_)
+#undef TOKEN_KEYWORD_
         // Special tokens:
         ERROR, END
     };
@@ -33,11 +61,15 @@ struct Token {
     Type type;
     uint16_t line;
     uint16_t col;
-    ObjString * string;
+    // Span of the token's text in the scanner's source (strings: between the quotes)
+    uint32_t start;
+    uint32_t length;
+    char const * message;  // ERROR tokens only
+    ObjString * string;    // the text interned, once the compiler asks for it
 
-    Token(): string(nullptr) {}
-    Token(Type t, uint16_t l, uint16_t c): type(t), line(l), col(c), string(nullptr) {}
-    Token(Type t, uint16_t l, uint16_t c, ObjString * s): type(t), line(l), col(c), string(s) {}
+    Token(): start(0), length(0), message(nullptr), string(nullptr) {}
+    Token(Type t, uint16_t l, uint16_t c, uint32_t s = 0, uint32_t len = 0)
+        : type(t), line(l), col(c), start(s), length(len), message(nullptr), string(nullptr) {}
 };
 
 class Scanner {
@@ -46,7 +78,9 @@ public:
     
     ~Scanner();
 
-    void init(Mem * mem, InputStream * stream);
+    // Scans the stream's buffer, or a copy of its characters if it doesn't have one
+    // line, col, offset: position in the source, when resuming part way through
+    void init(InputStream * stream, uint16_t line = 1, uint16_t col = 0, uint32_t offset = 0);
 
     Token scanToken();
 
@@ -54,6 +88,13 @@ public:
 
     InputStream * newCopyOfStream();
 
+    // The text of a token from this scanner (not null terminated)
+    char const * getChars(Token const & token) const { return source_ + token.start; }
+
+    uint16_t getLine() const { return line_; }
+    uint16_t getCol() const { return col_; }
+    uint32_t getOffset() const { return (uint32_t)(current_ - source_); }
+
     static uint16_t const MAX_LINES = 0xFFFF;
 
 private:
@@ -63,6 +104,8 @@ private:
                (c >= 'A' && c <= 'Z') ||
                 c == '_';
     }
+    // The end of the run of letters, digits and underscores starting at p
+    static char const * skipIdentifierChars_(char const * p, char const * end);
 
     bool isAtEnd_();
     char peek_();
@@ -71,20 +114,21 @@ private:
     void skipWhitespace_();
     bool matchNext_(char expected);
     
+    int tokenLength_() const { return (int)(current_ - tokenStr_); }
+
     Token makeToken_(Token::Type type);
     Token makeErrorToken_(const char* message);
     Token makeStringToken_();
     Token makeNumberToken_();
     Token makeIdentifierToken_();
     Token::Type identifierType_();
-    Token::Type checkKeyword_(int offset, int len, char const * rest, Token::Type type);
 
-    // Token string buffer:
-    static const char MAX_TOKEN_LEN = 64;
-    char tokenStr_[MAX_TOKEN_LEN];
-    uint16_t tokenStrLen_;
+    char const * source_;   // the whole source
+    char const * end_;
+    char const * current_;  // next character
+    char const * tokenStr_; // first character of the token being scanned
+    std::vector<char> copy_;  // source, for streams without a buffer
 
-    Mem * mem_;
     InputStream * stream_;
     uint16_t line_, col_;
 };
@@ -1,6 +1,8 @@
 
 #include "str.hpp"
 #include "mem.hpp"
+#include "number.hpp"
+#include "outputstream/outputstream.hpp"
 #include <string.h>
 #include <stdarg.h>
 
@@ -55,30 +57,46 @@ ObjString * ObjString::newStringFmt(Mem * mem, const char* fmt, ...) {
     vsnprintf(chars, len+1, fmt, args);
     va_end(args);
 
-    // is string already interned?
-    ObjString * ostr = mem->getInternedStrings()->find(chars, len);
-    if( ostr != nullptr ) return ostr;  // already have that one!
-
-    // make a new string
-    return new ObjString(mem, chars, len);
+    return newStringOwned_(mem, chars, len);
 }
 
 ObjString * ObjString::concatenate(Mem * mem, ObjString * a, ObjString * b) {
+    return concatenate(mem, a, b->get(), b->getLength());
+}
+
+ObjString * ObjString::concatenate(Mem * mem, ObjString * a, char const * b, int bLen) {
     // Make a new character array combining the strings
     int aLen = a->getLength();
-    int bLen = b->getLength();
     int len = aLen + bLen;
     char * chars = new char[len+1];
     memcpy(chars, a->get(), aLen);
-    memcpy(&chars[aLen], b->get(), bLen);
+    memcpy(&chars[aLen], b, bLen);
     chars[len] = '\0';
 
+    return newStringOwned_(mem, chars, len);
+}
+
+ObjString * ObjString::concatenate(Mem * mem, ObjString * a, double b) {
+    // Format the number straight into the end of the new character array
+    int aLen = a->getLength();
+    char * chars = new char[aLen + Number::MAX_CHARS + 1];
+    memcpy(chars, a->get(), aLen);
+    int len = aLen + Number::format(b, &chars[aLen]);
+    chars[len] = '\0';
+
+    return newStringOwned_(mem, chars, len);
+}
+
+ObjString * ObjString::newStringOwned_(Mem * mem, char * chars, int length) {
     // is string already interned?
-    ObjString * ostr = mem->getInternedStrings()->find(chars, len);
-    if( ostr != nullptr ) return ostr;  // already have that one!
+    ObjString * ostr = mem->getInternedStrings()->find(chars, length);
+    if( ostr != nullptr ){
+        delete[] chars;
+        return ostr;  // already have that one!
+    }
 
     // make a new string
-    return new ObjString(mem, chars, len);
+    return new ObjString(mem, chars, length);
 }
 
 ObjString::ObjString(Mem * mem, char const * chars, int length): Obj(mem)  {
@@ -94,12 +112,14 @@ ObjString::~ObjString() {
     delete[] chars_;
 }
 
-void ObjString::print(bool verbose) {
+void ObjString::print(OutputStream * out, bool verbose) {
     if( verbose ){
         // todo replace internal " with \":
-        printf("\"%s\"", chars_);
+        out->writeChar('"');
+        out->write(chars_, length_);
+        out->writeChar('"');
     }else{
-        printf("%s", chars_);
+        out->write(chars_, length_);
     }
 }
 
@@ -63,6 +63,17 @@ public:
      */
     static ObjString * concatenate(Mem * mem, ObjString * a, ObjString * b);
 
+    /**
+     * Constructor helper to make a string from a string and raw characters
+     */
+    static ObjString * concatenate(Mem * mem, ObjString * a, char const * b, int bLength);
+
+    /**
+     * Constructor helper to make a string from a string and a number,
+     * formatting the number directly into the new string
+     */
+    static ObjString * concatenate(Mem * mem, ObjString * a, double b);
+
     /**
      * Indexing into string:
      */
@@ -74,7 +85,7 @@ public:
 
     // implment Obj interface (trivial for strings)
     virtual ObjString * toString() override { return this; }
-    virtual void print(bool verbose) override;
+    virtual void print(OutputStream * out, bool verbose) override;
     virtual void gcMarkRefs() override {}
 
     // implement String interface:
@@ -87,6 +98,9 @@ private:
     // Takes ownership of str
     ObjString(Mem * mem, char const * str, int length);
 
+    // Intern a newly allocated character array, taking ownership of it
+    static ObjString * newStringOwned_(Mem * mem, char * chars, int length);
+
     char const * chars_;  // null terminated sequence
     int length_;          // number of characters, NOT including null terminator
     uint32_t hash_;
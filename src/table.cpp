@@ -1,5 +1,6 @@
 
 #include "table.hpp"
+#include "outputstream/stdiooutputstream.hpp"
 
 // ----------------------------------------------------------------------------
 // String Comparison Helpers
@@ -13,6 +14,35 @@ bool StringEqual::operator()(String const * lhs, String const * rhs) const {
             (memcmp(lhs->get(), rhs->get(), lhs->getLength()) == 0);
 }
 
+// ----------------------------------------------------------------------------
+// Value Comparison Helpers
+// ----------------------------------------------------------------------------
+static uint64_t numberBits_(double n) {
+    uint64_t bits;
+    memcpy(&bits, &n, sizeof(bits));
+    return bits;
+}
+
+std::size_t ValueHash::operator()(Value const & value) const {
+    std::size_t h;
+    switch( value.type ){
+        case Value::NIL:    h = 0; break;
+        case Value::BOOL:   h = value.as.boolean ? 1 : 0; break;
+        case Value::NUMBER: h = std::hash<uint64_t>()(numberBits_(value.as.number)); break;
+        case Value::TYPEID: h = (std::size_t)value.as.typeId; break;
+        // objects are equal by identity (strings are interned):
+        default:            h = std::hash<Obj*>()(value.as.obj); break;
+    }
+    return h ^ ((std::size_t)value.type * 0x9E3779B97F4A7C15ull);
+}
+
+bool ValueEqual::operator()(Value const & lhs, Value const & rhs) const {
+    if( lhs.isNumber() && rhs.isNumber() ){
+        return numberBits_(lhs.as.number) == numberBits_(rhs.as.number);
+    }
+    return lhs.equals(rhs);
+}
+
 // ----------------------------------------------------------------------------
 // InternedStringSet
 // ----------------------------------------------------------------------------
@@ -58,7 +88,7 @@ void StringSet::gcSweep() {
 
 #ifdef DEBUG_GC
             printf( "Remove unmarked interned string:" );
-            ((ObjString*) *it)->print(true);
+            ((ObjString*) *it)->print(StdioOutputStream::getStdout(), true);
             printf("\n");
 #endif
 
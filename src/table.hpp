@@ -3,6 +3,8 @@
 #include "str.hpp"
 #include "value.hpp"
 
+#include "outputstream/stdiooutputstream.hpp"
+
 #include "string.h"
 #include <unordered_set>
 #include <unordered_map>
@@ -21,6 +23,22 @@ struct StringEqual {
     bool operator()(String const * lhs, String const * rhs) const;
 };
 
+/**
+ * Hash value of a Value (for maps keyed by literal values)
+ * Numbers are hashed by their bits, so -0 and 0 are different keys
+ */
+struct ValueHash {
+    std::size_t operator()(Value const & value) const;
+};
+
+/**
+ * Compare two Values (for maps keyed by literal values)
+ * Numbers are compared by their bits, so -0 != 0 and nan == nan
+ */
+struct ValueEqual {
+    bool operator()(Value const & lhs, Value const & rhs) const;
+};
+
 /**
  * Set of strings. All elements must be ObjStrings
  * Key interface is used so we can do cheap lookups
@@ -94,7 +112,7 @@ public:
 
 #ifdef DEBUG_GC
             printf( "Mark key-value entry for key:" );
-            ((ObjString *)key)->print(true);
+            ((ObjString *)key)->print(StdioOutputStream::getStdout(), true);
             printf("\n");
 #endif
 
@@ -2,32 +2,18 @@
 #include "upvalue.hpp"
 #include "mem.hpp"
 #include "str.hpp"
+#include "outputstream/outputstream.hpp"
 
 
 ObjUpvalue * ObjUpvalue::newUpvalue(Mem * mem, Value * value) {
-    // Iterate linked list looking for upvalue pointing to the local:
-    ObjUpvalue * curr = mem->getRootOpenUpvalue();
-    ObjUpvalue * prev = nullptr;
-    // stop searching when we get to the end of the upvalue list
-    // or "after" the local we are looking for (list is sorted)
-    while( curr != nullptr && curr->value_ > value ) {
-        if( curr->value_ == value ){
-            // already exists:
-            return curr;
-        }
-        prev = curr;
-        curr = curr->nextUpvalue_;
+    // Look up the upvalue already pointing to the local, so we don't double up on capturing it:
+    ObjUpvalue * upvalue = mem->getOpenUpvalue(value);
+    if( upvalue != nullptr ){
+        return upvalue;
     }
     // not found: create upvalue
-    ObjUpvalue * upvalue = new ObjUpvalue(mem, value);
-
-    // wire into the linked list:
-    upvalue->next = curr;
-    if( prev == nullptr ){
-        mem->setRootOpenUpvalue(upvalue);
-    }else{
-        prev->next = upvalue;
-    }
+    upvalue = new ObjUpvalue(mem, value);
+    mem->setOpenUpvalue(value, upvalue);
     return upvalue;
 }
 
@@ -47,18 +33,24 @@ void ObjUpvalue::close() {
     value_ = &closedValue_;
 }
 
+void ObjUpvalue::reopen(Value * slot) {
+    *slot = closedValue_;
+    closedValue_ = Value::nil();
+    value_ = slot;
+    mem_->setOpenUpvalue(slot, this);
+}
+
 ObjString * ObjUpvalue::toString() {
     return ObjString::newString(mem_, "<upvalue>");
 }
 
-void ObjUpvalue::print(bool verbose) {
+void ObjUpvalue::print(OutputStream * out, bool verbose) {
     if( verbose ){
-        printf("<upvalue %s ",
-            value_ == &closedValue_ ? "closed" : "open");
-        value_->print(true);
-        printf(">");
+        out->writeString(value_ == &closedValue_ ? "<upvalue closed " : "<upvalue open ");
+        value_->print(out, true);
+        out->writeChar('>');
     }else{
-        printf("<upvalue>");
+        out->writeString("<upvalue>");
     }
 }
 
@@ -33,12 +33,12 @@ public:
      */
     void close();
 
-    // Get the next upvalue in the linked list of upvalues
-    inline ObjUpvalue * getNextUpvalue() { return nextUpvalue_; }
+    // Open the closed upvalue again on the stack slot, which takes the upvalue's value
+    void reopen(Value * slot);
 
     // implment Obj interface
     virtual ObjString * toString() override;
-    virtual void print(bool verbose) override;
+    virtual void print(OutputStream * out, bool verbose) override;
     virtual void gcMarkRefs() override;
 
 private:
@@ -47,7 +47,4 @@ private:
 
     Value * value_;
     Value closedValue_;
-
-    // linked list of upvalues so we don't double up on capturing locals:
-    ObjUpvalue * nextUpvalue_;
 };
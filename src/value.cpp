@@ -3,6 +3,9 @@
 #include "str.hpp"
 #include "function.hpp"
 #include "list.hpp"
+#include "floatarray.hpp"
+#include "number.hpp"
+#include "outputstream/outputstream.hpp"
 
 #include <stdio.h>
 
@@ -15,6 +18,10 @@ ObjList * Value::asObjList() const {
     return (ObjList *) as.obj;
 }
 
+ObjFloatArray * Value::asObjFloatArray() const {
+    return (ObjFloatArray *) as.obj;
+}
+
 ObjFunction * Value::asObjFunction() const {
     return (ObjFunction *) as.obj;
 }
@@ -27,6 +34,18 @@ ObjUpvalue * Value::asObjUpvalue() const {
     return (ObjUpvalue *) as.obj;
 }
 
+ObjNative * Value::asObjNative() const {
+    return (ObjNative *) as.obj;
+}
+
+ObjMemo * Value::asObjMemo() const {
+    return (ObjMemo *) as.obj;
+}
+
+ObjGenerator * Value::asObjGenerator() const {
+    return (ObjGenerator *) as.obj;
+}
+
 char const* Value::typeToString(Type t) {
     switch( t ){
         case NIL:      return "nil";
@@ -36,7 +55,11 @@ char const* Value::typeToString(Type t) {
         case FUNCTION: return "function";
         case CLOSURE:  return "closure";
         case UPVALUE:  return "upvalue";
+        case NATIVE:   return "native";
+        case MEMO:     return "memo";
+        case GENERATOR: return "generator";
         case LIST:     return "list";
+        case FLOAT_ARRAY: return "floatarray";
         case STRING:   return "string";
         default:       return "???";   // Unreachable
     }
@@ -54,9 +77,13 @@ void Value::gcMark() {
 
         case STRING:
         case LIST:
+        case FLOAT_ARRAY:
         case FUNCTION:
         case CLOSURE:
         case UPVALUE:
+        case NATIVE:
+        case MEMO:
+        case GENERATOR:
             // GC Object types:
             as.obj->gcMark();
             return;
@@ -74,7 +101,11 @@ bool Value::equals(Value other) const {
         case FUNCTION:  // function is only equal if its the exact same identity:
         case CLOSURE:   // TODO check if correct
         case UPVALUE:   // TODO check if correct
+        case NATIVE:
+        case MEMO:
+        case GENERATOR:
         case LIST:      // same for list, might be self referential so no safe way to deep inspect
+        case FLOAT_ARRAY:
         case STRING:    // all strings are interned --> therefore can compare pointers
             return as.obj == other.as.obj;
         default: return false;   // Unreachable
@@ -85,12 +116,19 @@ ObjString * Value::toString(Mem * mem) {
     switch( type ){
         case NIL:     return ObjString::newString(mem, "nil");
         case BOOL:    return ObjString::newString(mem, as.boolean ? "true" : "false");
-        case NUMBER:  return ObjString::newStringFmt(mem, "%g", as.number);
+        case NUMBER:{
+            char buf[Number::MAX_CHARS];
+            return ObjString::newString(mem, buf, Number::format(as.number, buf));
+        }
         case TYPEID:  return ObjString::newString(mem, typeToString(as.typeId));
         case FUNCTION:
         case CLOSURE:
         case UPVALUE:
+        case NATIVE:
+        case MEMO:
+        case GENERATOR:
         case LIST:
+        case FLOAT_ARRAY:
         case STRING:
             // Object types:
             return as.obj->toString();
@@ -98,19 +136,27 @@ ObjString * Value::toString(Mem * mem) {
     }
 }
 
-void Value::print(bool verbose) const {
+void Value::print(OutputStream * out, bool verbose) const {
     switch( type ){
-        case NIL:     printf("nil"); return;
-        case BOOL:    printf(as.boolean ? "true" : "false"); return;
-        case NUMBER:  printf("%g", as.number); return;
-        case TYPEID:  printf("%s", typeToString(as.typeId)); return;
+        case NIL:     out->writeString("nil"); return;
+        case BOOL:    out->writeString(as.boolean ? "true" : "false"); return;
+        case NUMBER:{
+            char buf[Number::MAX_CHARS];
+            out->write(buf, Number::format(as.number, buf));
+            return;
+        }
+        case TYPEID:  out->writeString(typeToString(as.typeId)); return;
         case FUNCTION:
         case CLOSURE:
         case UPVALUE:
+        case NATIVE:
+        case MEMO:
+        case GENERATOR:
         case LIST:
+        case FLOAT_ARRAY:
         case STRING:
             // Object types:
-            as.obj->print(verbose); return;
-        default:      printf("?%i", (int)type);
+            as.obj->print(out, verbose); return;
+        default:      out->writeChar('?');
     }
 }
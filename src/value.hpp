@@ -5,9 +5,13 @@
 // Predeclare object types
 class ObjString;
 class ObjList;
+class ObjFloatArray;
 class ObjFunction;
 class ObjClosure;
 class ObjUpvalue;
+class ObjNative;
+class ObjMemo;
+class ObjGenerator;
 
 struct Value {
     /**
@@ -22,9 +26,13 @@ struct Value {
         // Garbage-Collected Object Types:
         STRING,
         LIST,
+        FLOAT_ARRAY,
         FUNCTION,
         CLOSURE,
-        UPVALUE
+        UPVALUE,
+        NATIVE,
+        MEMO,
+        GENERATOR
     } type;
 
     union {
@@ -44,9 +52,13 @@ struct Value {
     }
     static inline Value string(Obj * o) { return (Value){STRING, {.obj = o}}; }
     static inline Value list(Obj * o) { return (Value){LIST, {.obj = o}}; }
+    static inline Value floatArray(Obj * o) { return (Value){FLOAT_ARRAY, {.obj = o}}; }
     static inline Value function(Obj * o) { return (Value){FUNCTION, {.obj = o}}; }
     static inline Value closure(Obj * o) { return (Value){CLOSURE, {.obj = o}}; }
     static inline Value upvalue(Obj * o) { return (Value){UPVALUE, {.obj = o}}; }
+    static inline Value native(Obj * o) { return (Value){NATIVE, {.obj = o}}; }
+    static inline Value memo(Obj * o) { return (Value){MEMO, {.obj = o}}; }
+    static inline Value generator(Obj * o) { return (Value){GENERATOR, {.obj = o}}; }
 
     // Type to string
     static char const * typeToString(Type t);
@@ -58,20 +70,28 @@ struct Value {
     inline bool isTypeId() const { return type == TYPEID; }
     inline bool isString() const { return type == STRING; }
     inline bool isList() const { return type == LIST; }
+    inline bool isFloatArray() const { return type == FLOAT_ARRAY; }
     inline bool isFunction() const { return type == FUNCTION; }
     inline bool isClosure() const { return type == CLOSURE; }
     inline bool isUpvalue() const { return type == UPVALUE; }
+    inline bool isNative() const { return type == NATIVE; }
+    inline bool isMemo() const { return type == MEMO; }
+    inline bool isGenerator() const { return type == GENERATOR; }
 
     // As object helpers:
     ObjString * asObjString() const;
     ObjList * asObjList() const;
+    ObjFloatArray * asObjFloatArray() const;
     ObjFunction * asObjFunction() const;
     ObjClosure * asObjClosure() const;
     ObjUpvalue * asObjUpvalue() const;
+    ObjNative * asObjNative() const;
+    ObjMemo * asObjMemo() const;
+    ObjGenerator * asObjGenerator() const;
 
     // value methods
     void gcMark();
     bool equals(Value other) const;
     ObjString * toString(Mem * mem);
-    void print(bool verbose) const;
+    void print(OutputStream * out, bool verbose) const;
 };
@@ -2,13 +2,21 @@
 #include "vm.hpp"
 #include "debug.hpp"
 #include "compiler.hpp"
+#include "bytecodecache.hpp"
 #include "list.hpp"
+#include "floatarray.hpp"
 #include "function.hpp"
+#include "natives.hpp"
+#include "memo.hpp"
+#include "generator.hpp"
+#include "outputstream/stdiooutputstream.hpp"
 
+#include <math.h>
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <unistd.h>
 
 
 uint16_t CallFrame::readUint16() {
@@ -16,14 +24,20 @@ uint16_t CallFrame::readUint16() {
     return (uint16_t)((ip[-2] << 8) | ip[-1]);
 }
 
-Value CallFrame::readLiteral() {
+uint32_t CallFrame::readUint24() {
+    ip += 3;
+    return ((uint32_t)ip[-3] << 16) | ((uint32_t)ip[-2] << 8) | ip[-1];
+}
+
+Value CallFrame::readLiteral(bool isLong) {
     // look up literal from bytecode reference
-    return closure->function->chunk.getLiteral(readByte());
+    uint32_t index = isLong ? readUint24() : readByte();
+    return closure->function->chunk.getLiteral(index);
 }
 
-ObjString * CallFrame::readString() {
+ObjString * CallFrame::readString(bool isLong) {
     // look up literal from bytecode and cast to string:
-    Value literal = readLiteral();
+    Value literal = readLiteral(isLong);
     assert(literal.isString());
     return literal.asObjString();
 }
@@ -33,21 +47,46 @@ int CallFrame::chunkOffsetOf(uint8_t * addr) {
     return (int)(addr - closure->function->chunk.getCode());
 }
 
-Vm::Vm() {
+Vm::Vm() : out_(STDOUT_FILENO) {
     compiler_ = nullptr;
+    cache_ = nullptr;
+    mem_.initStack(stack_, STACK_MAX);
     resetStack_();
 }
 
-void Vm::init() {
+void Vm::init(Options const & options) {
+    options_ = options;
     mem_.init(this);
+    defineNatives(this);
 }
 
 Vm::~Vm() {
 }
 
 InterpretResult Vm::interpret(char const * name, InputStream * stream) {
+    return compileAndRun_(name, stream, nullptr);
+}
+
+InterpretResult Vm::interpretFile(char const * path, InputStream * stream) {
+    // Disassembly is printed by the compiler, so it needs a fresh compile,
+    // and functions left uncompiled by a lazy compile can't be cached
+    if( !options_.useCache || options_.disassemble || options_.lazy ){
+        return compileAndRun_(path, stream, nullptr);
+    }
+
+    BytecodeCache cache(&mem_, options_);
+    cache_ = &cache;
+    ObjFunction * fn = cache.load(path);
+    cache_ = nullptr;
+    if( fn != nullptr ){
+        return run_(fn);
+    }
+    return compileAndRun_(path, stream, &cache);
+}
+
+InterpretResult Vm::compileAndRun_(char const * name, InputStream * stream, BytecodeCache * cache) {
     // Compile the source string to a function
-    compiler_ = new Compiler(&mem_);
+    compiler_ = new Compiler(&mem_, options_);
     ObjFunction * fn = compiler_->compile(name, stream);
     if( fn == nullptr ){
         // Failed to compile
@@ -56,13 +95,29 @@ InterpretResult Vm::interpret(char const * name, InputStream * stream) {
         compiler_ = nullptr;
         return InterpretResult::COMPILE_ERR;
     }
+
+    if( cache != nullptr ){
+        // Failing to write the cache only costs the next run a compile
+        cache->save(name, fn);
+    }
+
+    InterpretResult res = run_(fn);
+
+    // Done with compiler:
+    delete compiler_;
+    compiler_ = nullptr;
+
+    return res;
+}
+
+InterpretResult Vm::run_(ObjFunction * fn) {
     // NOTE: not in lox!
     resetStack_();
 
     // put the function on the value stack temporarily so that GC doesn't eat it
     push(Value::function(fn));
 
-    ObjClosure * closure = new ObjClosure(&mem_, fn);
+    ObjClosure * closure = ObjClosure::newClosure(&mem_, fn, 0);
     pop(); // remove function from stack
     push(Value::closure(closure));
 
@@ -75,9 +130,8 @@ InterpretResult Vm::interpret(char const * name, InputStream * stream) {
         assert(stackTop_ - stack_ == 0);
     }
 
-    // Done with compiler:
-    delete compiler_;
-    compiler_ = nullptr;
+    // Script is done: get the output out
+    out_.flush();
 
     return res;
 }
@@ -87,17 +141,25 @@ void Vm::gcMarkRoots() {
     for( Value * value = stack_; value < stackTop_; value++ ){
 #ifdef DEBUG_GC
         printf( "Mark value on stack:" );
-        value->print(true);
+        value->print(StdioOutputStream::getStdout(), true);
         printf("\n");
 #endif
         value->gcMark();
     }
 
+    // Mark running generators, whose frames are on the stack:
+    for( int i = 0; i < frameCount_; i++ ){
+        if( frames_[i].generator != nullptr ) frames_[i].generator->gcMark();
+    }
+
     // Mark global values:
     globals_.gcMark();
 
     // Mark compiler-owned objects:
-    compiler_->gcMarkRoots();
+    if( compiler_ ) compiler_->gcMarkRoots();
+
+    // Mark functions being loaded from a bytecode cache:
+    if( cache_ ) cache_->gcMarkRoots();
 }
 
 void Vm::push(Value value) {
@@ -140,42 +202,102 @@ bool Vm::binaryOp_(uint8_t op) {
     return true;
 }
 
-bool Vm::compareIterator_() {
-    Value aV = peek(1);
-    Value bV = peek(0);
-    if( !aV.isNumber() || !bV.isNumber() ){
-        runtimeError_("Operands must be numbers.");
+bool Vm::callValue_(Value fn, uint8_t argCount) {
+    if( fn.type == Value::NATIVE ){
+        return callNative_(fn.asObjNative(), argCount);
+    }
+    if( fn.type == Value::MEMO ){
+        return callMemo_(fn.asObjMemo(), argCount);
+    }
+    if( fn.type == Value::GENERATOR ){
+        // calling a generator gets its next value, or nil once it is done
+        if( argCount != 0 ){
+            runtimeError_("Expected 0 arguments, but got %d.", argCount);
+            return false;
+        }
+        return resume_(fn.asObjGenerator(), stackTop_ - 1, frames_[frameCount_ - 1].ip);
+    }
+    if( fn.type != Value::CLOSURE ){
+        runtimeError_("Can only call functions.");
         return false;
     }
+    return call_(fn.asObjClosure(), argCount);
+}
 
-    double b = bV.as.number;
-    double a = aV.as.number;
-    double diff = b - a;
-    if( abs(diff) < 1 ){
-        // consider different within 1 as equal
-        // we need this logic for for loops so they terminate correctly
-        push(Value::number( 0 ));
-    }else{
-        push(Value::number( diff > 0 ? 1 : -1 ));
+bool Vm::callNative_(ObjNative * native, uint8_t argCount) {
+    if( argCount < native->minInputs || argCount > native->maxInputs ){
+        if( native->minInputs == native->maxInputs ){
+            runtimeError_("Expected %d arguments, but got %d.", native->minInputs, argCount);
+        }else{
+            runtimeError_("Expected %d to %d arguments, but got %d.",
+                native->minInputs, native->maxInputs, argCount);
+        }
+        return false;
     }
+
+    // The arguments stay on the stack, protected from GC, until the result replaces the call
+    Value result = Value::nil();
+    if( !native->fn(this, argCount, stackTop_ - argCount, &result) ) return false;
+    stackTop_ -= argCount;
+    stackTop_[-1] = result;
     return true;
 }
 
-bool Vm::callValue_(Value fn, uint8_t argCount) {
-    if( fn.type != Value::CLOSURE ){
-        runtimeError_("Can only call functions.");
-        return false;
+bool Vm::callMemo_(ObjMemo * memo, uint8_t argCount) {
+    Value result;
+    if( memo->lookup(stackTop_ - argCount, argCount, result) ){
+        // seen before: the result replaces the call, like a native
+        stackTop_ -= argCount;
+        stackTop_[-1] = result;
+        return true;
     }
-    return call_(fn.asObjClosure(), argCount);
+    int frameCount = frameCount_;
+    if( !call_(memo->closure, argCount) ) return false;
+    // a new generator each call, so nothing to keep:
+    if( frameCount_ == frameCount ) return true;
+    frames_[frameCount_ - 1].memo = memo;
+    memo->beginCall();
+    return true;
+}
+
+void Vm::defineNative(char const * name, int minInputs, int maxInputs, NativeFn fn) {
+    // keep the name and function on the stack while allocating, for GC
+    push(Value::string(ObjString::newString(&mem_, name)));
+    push(Value::native(new ObjNative(&mem_, peek(0).asObjString(), minInputs, maxInputs, fn)));
+    globals_.set(peek(1).asObjString(), {peek(0), true});
+    pop(2);
+}
+
+bool Vm::nativeError(const char* format, ...) {
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    runtimeError_("%s", message);
+    return false;
 }
 
 bool Vm::call_(ObjClosure * closure, uint8_t argCount) {
+    if( closure->function->lazy != nullptr && !compileLazy_(closure->function) ){
+        return false;
+    }
+
     if( argCount != closure->function->numInputs ){
         runtimeError_("Expected %d arguments, but got %d.",
             closure->function->numInputs, argCount);
         return false;
     }
 
+    if( closure->function->isGenerator ){
+        // The body waits to be resumed, in a frame of the generator's own:
+        Value * slots = stackTop_ - argCount - 1;
+        ObjGenerator * generator = new ObjGenerator(&mem_, closure, slots, argCount + 1);
+        stackTop_ = slots + 1;
+        slots[0] = Value::generator(generator);
+        return true;
+    }
+
     if( frameCount_ >= FRAMES_MAX ){
         runtimeError_("Stack overflow.");
         return false;
@@ -185,9 +307,52 @@ bool Vm::call_(ObjClosure * closure, uint8_t argCount) {
     frame->closure = closure;
     frame->ip = closure->function->chunk.getCode();
     frame->slots = stackTop_ - argCount - 1;
+    frame->memo = nullptr;
+    frame->generator = nullptr;
     return true;
 }
 
+bool Vm::resume_(ObjGenerator * generator, Value * target, uint8_t * doneIp) {
+    if( generator->state == ObjGenerator::RUNNING ){
+        runtimeError_("Generator is already running.");
+        return false;
+    }
+    if( generator->state == ObjGenerator::DONE ){
+        *target = Value::nil();
+        frames_[frameCount_ - 1].ip = doneIp;
+        return true;
+    }
+    if( frameCount_ >= FRAMES_MAX ){
+        runtimeError_("Stack overflow.");
+        return false;
+    }
+
+    CallFrame * frame = &frames_[frameCount_++];
+    frame->closure = generator->closure;
+    frame->ip = generator->ip;
+    frame->slots = stackTop_;
+    frame->memo = nullptr;
+    frame->generator = generator;
+    stackTop_ = generator->resume(frame->slots);
+    generator->target = target;
+    generator->doneIp = doneIp;
+    return true;
+}
+
+bool Vm::compileLazy_(ObjFunction * fn) {
+    // The script's compiler is finished with, so it doesn't need marking meanwhile
+    Compiler * scriptCompiler = compiler_;
+    Compiler compiler(&mem_, options_);
+    compiler_ = &compiler;
+    bool ok = compiler.compileLazy(fn);
+    compiler_ = scriptCompiler;
+
+    if( !ok ){
+        runtimeError_("Failed to compile function '%s'.", fn->name->get());
+    }
+    return ok;
+}
+
 bool Vm::isTruthy_(Value value) {
     switch( value.type ){
         case Value::NIL:  return false;
@@ -228,13 +393,63 @@ bool Vm::indexGet_() {
         push(v);
         return true;
     }
+    case Value::FLOAT_ARRAY:{
+        double n;
+        if( !value.asObjFloatArray()->get(i, n) ){
+            runtimeError_("Index out of bounds: %i", i);
+            return false;
+        }
+        push(Value::number(n));
+        return true;
+    }
     default:
         runtimeError_("Cannot index %s", Value::typeToString(value.type));
         return false;
     }
 }
 
+bool Vm::indexSet_() {
+    Value v = pop();
+    Value index = pop();
+    Value value = pop();
+
+    if( !index.isNumber() ){
+        runtimeError_("Index must be a number");
+        return false;
+    }
+    int i = (int) index.as.number;
+
+    switch( value.type ){
+    case Value::LIST:{
+        if( !value.asObjList()->set(i, v) ){
+            runtimeError_("Index out of bounds: %i", i);
+            return false;
+        }
+        break;
+    }
+    case Value::FLOAT_ARRAY:{
+        if( !v.isNumber() ){
+            runtimeError_("Cannot store %s in a float array", Value::typeToString(v.type));
+            return false;
+        }
+        if( !value.asObjFloatArray()->set(i, v.as.number) ){
+            runtimeError_("Index out of bounds: %i", i);
+            return false;
+        }
+        break;
+    }
+    default:
+        runtimeError_("Cannot assign to an index of %s", Value::typeToString(value.type));
+        return false;
+    }
+    // assignment is an expression, its result is the assigned value:
+    push(v);
+    return true;
+}
+
 void Vm::resetStack_() {
+    // upvalues left open by a runtime error mustn't be found by later captures
+    mem_.closeUpvalues(stack_);
     stackTop_ = stack_;
     frameCount_ = 0;
 }
@@ -275,16 +490,11 @@ InterpretResult Vm::run_() {
                if ( stackPos == frame->slots ){
                   printf("SF: "); // Stack Frame
                }
-               stackPos->print(true);
+               stackPos->print(StdioOutputStream::getStdout(), true);
            }
            printf("\n");
            printf("open-upvalues: ");
-           ObjUpvalue * upvalue = mem_.getRootOpenUpvalue();
-           while( upvalue != nullptr ){
-               upvalue->print(true);
-               upvalue = upvalue->getNextUpvalue();
-               if ( upvalue != nullptr ) printf(" | ");
-           }
+           mem_.printOpenUpvalues();
            printf("\n");
 
            disasm.disassembleInstruction(&frame->closure->function->chunk,
@@ -306,10 +516,23 @@ InterpretResult Vm::run_() {
                 push(frame->readLiteral());
                 break;
             }
-            case OpCode::CLOSURE:{
+            case OpCode::LITERAL_LONG:{
+                push(frame->readLiteral(true));
+                break;
+            }
+            case OpCode::CLOSURE:
+            case OpCode::CLOSURE_LONG:{
                 // Wrap the function literal into a closure:
-                ObjFunction * function = frame->readLiteral().asObjFunction();
-                ObjClosure * closure = new ObjClosure(&mem_, function);
+                ObjFunction * function = frame->readLiteral(instr == OpCode::CLOSURE_LONG).asObjFunction();
+                if( function->numUpvalues == 0 ){
+                    // Nothing to capture, so every evaluation can share one closure:
+                    if( function->closure == nullptr ){
+                        function->closure = ObjClosure::newClosure(&mem_, function, 0);
+                    }
+                    push(Value::closure(function->closure));
+                    break;
+                }
+                ObjClosure * closure = ObjClosure::newClosure(&mem_, function, function->numUpvalues);
                 push(Value::closure(closure));
 
                 // Close over referenced Values (upvalues):
@@ -317,16 +540,23 @@ InterpretResult Vm::run_() {
                     uint8_t isLocal = frame->readByte();
                     uint8_t index = frame->readByte();
 
-                    closure->upvalues.push_back(
-                        isLocal ? 
+                    closure->upvalues()[i] = isLocal ?
                         // capture local value to upvalue:
                         ObjUpvalue::newUpvalue(&mem_, &frame->slots[index]) :
                         // else, reference existing upvalue
-                        frame->closure->upvalues[index]
-                    );
+                        frame->closure->upvalues()[index];
                 }
                 break;
             }
+            case OpCode::CLOSURE_STACK:{
+                // The closure can't outlive this frame, so it uses the frame's slots directly:
+                ObjFunction * function = frame->readLiteral().asObjFunction();
+                ObjClosure * closure = ObjClosure::newClosure(&mem_, function, 0);
+                closure->enclosingSlots = frame->slots;
+                push(Value::closure(closure));
+                frame->ip += 2 * function->numUpvalues;  // skip the (isLocal, index) pairs
+                break;
+            }
             case OpCode::NIL: push(Value::nil()); break;
             case OpCode::TRUE: push(Value::boolean(true)); break;
             case OpCode::FALSE: push(Value::boolean(false)); break;
@@ -337,18 +567,37 @@ InterpretResult Vm::run_() {
             case OpCode::TYPE_TYPEID:   push(Value::typeId(Value::TYPEID)); break;
             case OpCode::POP: pop(); break;
 
+            case OpCode::PEEK: push(peek(frame->readByte())); break;
+
+            case OpCode::POP_UNDER: {
+                Value result = pop();
+                pop(frame->readByte());
+                push(result);
+                break;
+            }
+
             case OpCode::DEFINE_GLOBAL_VAR:
-            case OpCode::DEFINE_GLOBAL_CONST: {
-                ObjString * name = frame->readString();
-                bool isConst = instr==OpCode::DEFINE_GLOBAL_CONST;
+            case OpCode::DEFINE_GLOBAL_VAR_LONG:
+            case OpCode::DEFINE_GLOBAL_CONST:
+            case OpCode::DEFINE_GLOBAL_CONST_LONG: {
+                ObjString * name = frame->readString(
+                    instr == OpCode::DEFINE_GLOBAL_VAR_LONG || instr == OpCode::DEFINE_GLOBAL_CONST_LONG);
+                bool isConst = instr==OpCode::DEFINE_GLOBAL_CONST || instr==OpCode::DEFINE_GLOBAL_CONST_LONG;
                 if( !globals_.add(name, {peek(0), isConst}) ){
-                    return runtimeError_("Redeclaration of variable '%s'.", name->get());
+                    // a script may use the name of a built-in function for its own
+                    Global existing;
+                    globals_.get(name, existing);
+                    if( !existing.value.isNative() ){
+                        return runtimeError_("Redeclaration of variable '%s'.", name->get());
+                    }
+                    globals_.set(name, {peek(0), isConst});
                 }
                 pop(); // Note: lox has this late pop as `set` might trigger garbage collection
                 break;
             }
-            case OpCode::GET_GLOBAL: {
-                ObjString * name = frame->readString();
+            case OpCode::GET_GLOBAL:
+            case OpCode::GET_GLOBAL_LONG: {
+                ObjString * name = frame->readString(instr == OpCode::GET_GLOBAL_LONG);
                 Global global;
                 if( !globals_.get(name, global) ){
                     return runtimeError_("Undefined variable '%s'.", name->get());
@@ -356,8 +605,9 @@ InterpretResult Vm::run_() {
                 push(global.value);
                 break;
             }
-            case OpCode::SET_GLOBAL: {
-                ObjString * name = frame->readString();
+            case OpCode::SET_GLOBAL:
+            case OpCode::SET_GLOBAL_LONG: {
+                ObjString * name = frame->readString(instr == OpCode::SET_GLOBAL_LONG);
                 Global global;
                 if( !globals_.get(name, global) ){
                     return runtimeError_("Undefined variable '%s'.", name->get());
@@ -382,12 +632,22 @@ InterpretResult Vm::run_() {
             }
             case OpCode::GET_UPVALUE: {
                 uint8_t upvalueIdx = frame->readByte();
-                push( frame->closure->upvalues[upvalueIdx]->get() );
+                push( frame->closure->upvalues()[upvalueIdx]->get() );
                 break;
             }
             case OpCode::SET_UPVALUE: {
                 uint8_t upvalueIdx = frame->readByte();
-                frame->closure->upvalues[upvalueIdx]->set( peek(0) );
+                frame->closure->upvalues()[upvalueIdx]->set( peek(0) );
+                break;
+            }
+            case OpCode::GET_ENCLOSING: {
+                uint8_t slot = frame->readByte();
+                push( frame->closure->enclosingSlots[slot] );
+                break;
+            }
+            case OpCode::SET_ENCLOSING: {
+                uint8_t slot = frame->readByte();
+                frame->closure->enclosingSlots[slot] = peek(0);
                 break;
             }
             case OpCode::CLOSE_UPVALUE: {
@@ -400,10 +660,6 @@ InterpretResult Vm::run_() {
                 push(Value::boolean( pop().equals(pop()) ));
                 break;
             }
-            case OpCode::COMPARE_ITERATOR: {
-                compareIterator_();
-                break;
-            }
             case OpCode::NOT_EQUAL: {
                 push(Value::boolean( !pop().equals(pop()) ));
                 break;
@@ -424,6 +680,12 @@ InterpretResult Vm::run_() {
                     double a = pop().as.number;
                     push(Value::number( a + b ));
 
+                }else if( peek(1).isString() && peek(0).isNumber() ){
+                    // format the number straight into the concatenated string
+                    double b = pop().as.number;
+                    ObjString * a = pop().asObjString();
+                    push( Value::string(ObjString::concatenate(&mem_, a, b)) );
+
                 }else if( peek(1).isString() ){  // the first argument is second on stack
                     // implicitly convert second operand to string
                     Value bValue = pop();
@@ -432,20 +694,20 @@ InterpretResult Vm::run_() {
                     push( Value::string(ObjString::concatenate(&mem_, a, b)) );
 
                 }else if( peek(1).isList() && peek(0).isList() ){
-                    // Concatenate two lists
+                    // Concatenate two lists, extending a's storage if possible
                     ObjList * list = new ObjList(&mem_);
                     ObjList * b = pop().asObjList();
                     ObjList * a = pop().asObjList();
-                    list->concat(a);
+                    list->share(a);
                     list->concat(b);
                     push( Value::list(list) );
 
                 }else if( peek(1).isList() ){
-                    // Copy a list and append a value
+                    // Copy a list and append a value, extending a's storage if possible
                     ObjList * list = new ObjList(&mem_);
                     Value b = pop();
                     ObjList * a = pop().asObjList();
-                    list->concat(a);
+                    list->share(a);
                     list->append(b);
                     push( Value::list(list) );
 
@@ -469,14 +731,14 @@ InterpretResult Vm::run_() {
                 break;
             }
             case OpCode::ECHO:{
-                pop().print(true);
-                printf("\n");
+                pop().print(&out_, true);
+                out_.writeChar('\n');
                 push(Value::nil());  // echo returns nil
                 break;
             }
             case OpCode::PRINT:{
-                pop().print(false);
-                printf("\n");
+                pop().print(&out_, false);
+                out_.writeChar('\n');
                 push(Value::nil());  // print returns nil
                 break;
             }
@@ -503,7 +765,9 @@ InterpretResult Vm::run_() {
                 break;
             }
             case OpCode::INDEX_SET:{
-                // TODO
+                if( !indexSet_() ){
+                    return InterpretResult::RUNTIME_ERR;
+                }
                 break;
             }
             case OpCode::JUMP:{
@@ -536,10 +800,83 @@ InterpretResult Vm::run_() {
                 if( !isTruthy_(pop()) ) frame->ip += offset;
                 break;
             }
-            case OpCode::JUMP_IF_ZERO:{
+            case OpCode::FOR_PREP:
+            case OpCode::FOR_PREP_INCLUSIVE:{
+                uint8_t slot = frame->readByte();
                 uint16_t offset = frame->readUint16();
-                Value a = peek(0);
-                if( a.type == Value::NUMBER && a.as.number == 0.0 ) frame->ip += offset;
+                Value * iterator = &frame->slots[slot];  // followed by the limit
+                if( !iterator[0].isNumber() || !iterator[1].isNumber() ){
+                    if( instr == OpCode::FOR_PREP && iterator[1].isGenerator() ){
+                        // `for x in generator`: nil in place of the step, and each value yielded starts the body
+                        push(Value::nil());
+                        if( !resume_(iterator[1].asObjGenerator(), &iterator[0], frame->ip + offset) ){
+                            return InterpretResult::RUNTIME_ERR;
+                        }
+                        frame = &frames_[frameCount_ - 1];
+                        break;
+                    }
+                    runtimeError_("Operands must be numbers.");
+                    return InterpretResult::RUNTIME_ERR;
+                }
+                double step = iterator[1].as.number > iterator[0].as.number ? 1 : -1;
+                if( instr == OpCode::FOR_PREP_INCLUSIVE ) iterator[1].as.number += step;
+                push(Value::number(step));
+                // values within 1 of each other count as equal, so fractional ranges end
+                if( fabs(iterator[1].as.number - iterator[0].as.number) < 1 ) frame->ip += offset;
+                break;
+            }
+            case OpCode::JUMP_TABLE:{
+                int16_t min = (int16_t)frame->readUint16();
+                uint16_t count = frame->readUint16();
+                Value value = peek(0);
+                double index = value.isNumber() ? value.as.number - min : -1;
+                int entry = index >= 0 && index < count && index == floor(index) ? (int)index : count;
+                frame->ip += 3 * entry;  // to its JUMP or LOOP
+                break;
+            }
+            case OpCode::SWITCH_STRING:{
+                uint16_t count = frame->readUint16();
+                uint8_t bits = frame->readByte();
+                uint8_t * table = frame->ip;
+                uint8_t * literals = table + (2 << bits);
+                frame->ip = literals + 3 * count;
+
+                int entry = count;
+                Value value = peek(0);
+                if( value.isString() ){
+                    // strings are interned, so the case with the same object matches:
+                    ObjString * str = value.asObjString();
+                    uint32_t mask = (1u << bits) - 1;
+                    for( uint32_t slot = str->getHash() & mask; ; slot = (slot + 1) & mask ){
+                        int c = (table[2 * slot] << 8) | table[2 * slot + 1];
+                        if( c == UINT16_MAX ) break;
+                        uint8_t * literal = literals + 3 * c;
+                        uint32_t index = ((uint32_t)literal[0] << 16) | ((uint32_t)literal[1] << 8) | literal[2];
+                        if( frame->closure->function->chunk.getLiteral(index).asObjString() == str ){
+                            entry = c;
+                            break;
+                        }
+                    }
+                }
+                frame->ip += 3 * entry;  // to its JUMP or LOOP
+                break;
+            }
+            case OpCode::FOR_STEP:{
+                uint8_t slot = frame->readByte();
+                uint16_t offset = frame->readUint16();
+                Value * iterator = &frame->slots[slot];  // followed by the limit and step
+                if( !iterator[2].isNumber() ){
+                    // iterating a generator: the next value yielded starts the body again
+                    uint8_t * end = frame->ip;
+                    frame->ip -= offset;
+                    if( !resume_(iterator[1].asObjGenerator(), &iterator[0], end) ){
+                        return InterpretResult::RUNTIME_ERR;
+                    }
+                    frame = &frames_[frameCount_ - 1];
+                    break;
+                }
+                iterator[0].as.number += iterator[2].as.number;
+                if( fabs(iterator[1].as.number - iterator[0].as.number) >= 1 ) frame->ip -= offset;
                 break;
             }
             case OpCode::CALL: {
@@ -561,11 +898,24 @@ InterpretResult Vm::run_() {
             case OpCode::RETURN:{
                 // return value(s) of function:
                 Value result = pop();
+                if( frame->memo != nullptr ) frame->memo->endCall(result);
 
                 // close upvalues of function
                 Value * newStackTop = frame->slots;
                 mem_.closeUpvalues(newStackTop);
 
+                if( frame->generator != nullptr ){
+                    // a finished generator gives nil, and its resumer carries on past wherever it asked
+                    ObjGenerator * generator = frame->generator;
+                    generator->finish();
+                    stackTop_ = newStackTop;
+                    frameCount_--;
+                    *generator->target = Value::nil();
+                    frame = &frames_[frameCount_ - 1];
+                    frame->ip = generator->doneIp;
+                    break;
+                }
+
                 // Check if we are returning from the top level script:
                 if( --frameCount_ == 0 ){
                     pop();
@@ -582,6 +932,17 @@ InterpretResult Vm::run_() {
                 frame = &frames_[frameCount_ - 1];
                 break;
             }
+            case OpCode::YIELD:{
+                // Keep the frame in the generator, and give the resumer the value as if returned:
+                ObjGenerator * generator = frame->generator;
+                Value value = peek(0);
+                generator->suspend(frame->slots, stackTop_, frame->ip);
+                stackTop_ = frame->slots;
+                frameCount_--;
+                *generator->target = value;
+                frame = &frames_[frameCount_ - 1];
+                break;
+            }
             default:
                 return runtimeError_("Fatal: unknown opcode %d\n", (int)instr);
         }
@@ -589,6 +950,9 @@ InterpretResult Vm::run_() {
 }
 
 InterpretResult Vm::runtimeError_(const char* format, ...) {
+    // Get output so far out before the error:
+    out_.flush();
+
     va_list args;
     va_start(args, format);
     vfprintf(stderr, format, args);
@@ -597,8 +961,15 @@ InterpretResult Vm::runtimeError_(const char* format, ...) {
 
     for( int i = frameCount_ - 1; i >= 0; i-- ){
         CallFrame * frame = &frames_[i];
+        if( frame->memo != nullptr ) frame->memo->abandonCalls();
+        if( frame->generator != nullptr ) frame->generator->finish();
         ObjFunction * fn = frame->closure->function;
         int offset = frame->chunkOffsetOf(frame->ip - 1);
+        InlinedCall const * inlined = fn->chunk.getInlinedCall(offset);
+        if( inlined != nullptr ){
+            fprintf(stderr, "[line %d] in %s\n",
+                    inlined->line, fn->chunk.getLiteral(inlined->name).asObjString()->get());
+        }
         fprintf(stderr, "[line %d] in %s\n", 
                 fn->chunk.getLineNumber(offset),
                 fn->name->get());
@@ -5,12 +5,16 @@
 #include "value.hpp"
 #include "object.hpp"
 #include "table.hpp"
+#include "options.hpp"
+#include "function.hpp"
 #include "inputstream/inputstream.hpp"
+#include "outputstream/fileoutputstream.hpp"
 
 #include <unordered_map>
 
 // Predeclare compiler
 class Compiler;
+class BytecodeCache;
 
 enum class InterpretResult {
     OK,
@@ -21,13 +25,16 @@ enum class InterpretResult {
 struct CallFrame {
     inline uint8_t readByte() { return *ip++; }
     uint16_t readUint16();
-    Value readLiteral();
-    ObjString * readString();
+    uint32_t readUint24();
+    Value readLiteral(bool isLong = false);      // isLong: 3 byte literal index
+    ObjString * readString(bool isLong = false);
     int chunkOffsetOf(uint8_t * addr);  // instruction address to chunk offset
 
     ObjClosure * closure;
     uint8_t * ip;   // instruction pointer
     Value * slots;  // first value in stack which can be used by function
+    ObjMemo * memo; // to store the result in when it returns, or nullptr
+    ObjGenerator * generator;  // whose body the frame runs, or nullptr
 };
 
 struct Global {
@@ -45,10 +52,13 @@ public:
     Vm();
     ~Vm();
 
-    void init();
+    void init(Options const & options = Options());
 
     InterpretResult interpret(char const * name, InputStream * stream);
 
+    // Like interpret, but loads a fresh bytecode cache instead of compiling, or saves one after
+    InterpretResult interpretFile(char const * path, InputStream * stream);
+
     // Mark root objects to preserve from garbage collection:
     void gcMarkRoots();
 
@@ -58,24 +68,46 @@ public:
     void pop(int n);
     Value peek(int index);  // index counts from top (end) of stack
 
+    Mem * getMem() { return &mem_; }
+
+    // Make a built-in function available to scripts as a const global
+    void defineNative(char const * name, int minInputs, int maxInputs, NativeFn fn);
+
+    // Write out what print and echo have buffered so far
+    void flushOutput() { out_.flush(); }
+
+    // Report a runtime error from within a native function
+    // @return false, for the native to return
+    bool nativeError(const char* format, ...);
+
 private:
     void resetStack_();
+    InterpretResult compileAndRun_(char const * name, InputStream * stream, BytecodeCache * cache);
+    InterpretResult run_(ObjFunction * fn);  // run a script function
     InterpretResult run_();
     bool call_(ObjClosure * fn, uint8_t argCount);
+    bool compileLazy_(ObjFunction * fn);  // compile the body of a function on its first call
     bool callValue_(Value value, uint8_t argCount);
+    bool callNative_(ObjNative * native, uint8_t argCount);
+    bool callMemo_(ObjMemo * memo, uint8_t argCount);
+    // Run a generator until it yields a value into target, or finishes and the resumer carries on from doneIp
+    bool resume_(ObjGenerator * generator, Value * target, uint8_t * doneIp);
     bool binaryOp_(uint8_t op);
-    bool compareIterator_();
     bool isTruthy_(Value value);
     void concatenate_();
     bool indexGet_();
+    bool indexSet_();
     InterpretResult runtimeError_(const char* format, ...);
 
     static int const FRAMES_MAX = 64;
     static int const STACK_MAX = FRAMES_MAX * 256;
 
     Mem mem_;
+    Options options_;
     Compiler * compiler_;
-    CallFrame frames_[FRAMES_MAX];  // TODO to allow continuations/generators, this can't be a stack, GC instead
+    BytecodeCache * cache_;  // while loading a cache
+    FileOutputStream out_;  // buffered stdout for print/echo
+    CallFrame frames_[FRAMES_MAX];  // a suspended generator keeps its frame in its ObjGenerator instead
     int frameCount_;
     Value stack_[STACK_MAX];
     Value * stackTop_;  // points past the last value in the stack
@@ -2,9 +2,10 @@
 
 SIGIL=./bin/sigil
 
-# Clear previous test results:
+# Clear previous test results and bytecode caches:
 rm -rf test/out
 mkdir test/out
+rm -f test/scripts/*.sigilc
 
 RESULT="OK"
 
@@ -14,8 +15,14 @@ do
     EXPECTED=test/scripts/$NAME.expected
     OUT=test/out/$NAME.out
     ERR=test/out/$NAME.err
+    # Optional command line flags for the script:
+    FLAGS=""
+    if [ -f test/scripts/$NAME.flags ]
+    then
+        FLAGS=`cat test/scripts/$NAME.flags`
+    fi
     echo "==== $SCRIPT ===="
-    $SIGIL $SCRIPT > $OUT 2> $ERR
+    $SIGIL $FLAGS $SCRIPT > $OUT 2> $ERR
     diff $EXPECTED $OUT -B
     if [ $? -ne 0 ]
     then
@@ -30,8 +37,59 @@ do
         cat $ERR
         echo ""
     fi
+    # Run again from the bytecode cache written by the first run:
+    if [ -f test/scripts/$NAME.sigilc ]
+    then
+        $SIGIL $FLAGS $SCRIPT > $OUT.cached 2> $ERR.cached
+        diff $OUT $OUT.cached
+        if [ $? -ne 0 ]
+        then
+            RESULT="FAILURE"
+            echo "--- Output differs when run from the bytecode cache ---"
+            cat $ERR.cached
+            echo ""
+        fi
+    fi
+    # Run from the cache damaged at each "offset value" listed in turn, which must be ignored:
+    if [ -f test/scripts/$NAME.damage ] && [ -f test/scripts/$NAME.sigilc ]
+    then
+        cp test/scripts/$NAME.sigilc test/out/$NAME.sigilc
+        while read OFFSET VALUE DESCRIPTION
+        do
+            cp test/out/$NAME.sigilc test/scripts/$NAME.sigilc
+            printf "\\$(printf '%03o' $VALUE)" | dd of=test/scripts/$NAME.sigilc bs=1 seek=$OFFSET conv=notrunc 2> /dev/null
+            $SIGIL $FLAGS $SCRIPT > $OUT.damaged 2> $ERR.damaged
+            diff $EXPECTED $OUT.damaged -B
+            if [ $? -ne 0 ]
+            then
+                RESULT="FAILURE"
+                echo "--- Output differs when run from a cache damaged at $OFFSET ($DESCRIPTION) ---"
+                cat $ERR.damaged
+                echo ""
+            fi
+        done < test/scripts/$NAME.damage
+    fi
+    # Run each "source|message" line (with \n for newlines) as a script of its own, with the same flags, which
+    # must stop with an error containing the message:
+    if [ -f test/scripts/$NAME.errors ]
+    then
+        while IFS='|' read -r SOURCE MESSAGE
+        do
+            printf '%b\n' "$SOURCE" > test/out/$NAME.error.sigil
+            $SIGIL $FLAGS --no-cache test/out/$NAME.error.sigil > /dev/null 2> $ERR.error
+            if [ $? -eq 0 ] || ! grep -q -F "$MESSAGE" $ERR.error
+            then
+                RESULT="FAILURE"
+                echo "--- Expected the error '$MESSAGE' from: $SOURCE ---"
+                cat $ERR.error
+                echo ""
+            fi
+        done < test/scripts/$NAME.errors
+    fi
 done
 
+rm -f test/scripts/*.sigilc
+
 echo $RESULT
 if [ $RESULT != "OK" ]
 then